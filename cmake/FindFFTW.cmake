@@ -6,13 +6,15 @@
 # It sets the following variables:
 #   FFTW_FOUND
 #   FFTW_INCLUDES
-#   FFTW_LIBRARIES
+#   FFTW_LIBRARIES         (single precision, fftw3f)
+#   FFTW_DOUBLE_LIBRARIES  (double precision, fftw3, optional)
 
 find_path(FFTW_INCLUDES fftw3.h)
 find_library(FFTW_LIBRARIES NAMES fftw3f)
+find_library(FFTW_DOUBLE_LIBRARIES NAMES fftw3)
 
 include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args(FFTW DEFAULT_MSG
     FFTW_INCLUDES FFTW_LIBRARIES)
 
-mark_as_advanced(FFTW_INCLUDES FFTW_LIBRARIES)
+mark_as_advanced(FFTW_INCLUDES FFTW_LIBRARIES FFTW_DOUBLE_LIBRARIES)
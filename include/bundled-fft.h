@@ -0,0 +1,392 @@
+#ifndef DOSCALC_BUNDLED_FFT_DEF
+#define DOSCALC_BUNDLED_FFT_DEF
+
+#include "precision.h"
+#include <complex.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// dependency free FFT with the part of the FFTW interface that dos-calc
+// uses (see fft-backend.h), in the working precision
+// mixed radix Cooley-Tukey for lengths with prime factors up to
+// BFFT_MAX_RADIX, Bluestein's algorithm (a convolution of power of two
+// length) otherwise
+// transforms are unnormalized like FFTW's, plans can be executed by several
+// threads at the same time, the planner flags are ignored
+
+#ifdef DOUBLE_PRECISION
+typedef double complex bfft_complex;
+#else
+typedef float complex bfft_complex;
+#endif
+
+typedef struct {
+    int n;
+    int is;
+    int os;
+} bfft_iodim;
+
+// largest prime factor done by a butterfly, larger ones by Bluestein
+#define BFFT_MAX_RADIX 31
+
+// complex forward transform of length n
+typedef struct bfft_complex_plan {
+    size_t n;
+    size_t nfactors;
+    size_t factors[64];
+    bfft_complex *twiddles; // exp(-2 pi i j / n), j < n
+    // Bluestein (nconv > 0)
+    size_t nconv;
+    bfft_complex *chirp;         // exp(-i pi j^2 / n), j < n
+    bfft_complex *chirp_fourier; // transform of the conjugate chirp
+    struct bfft_complex_plan *conv_plan;
+} bfft_complex_plan;
+
+// 'r' r2c, 'c' c2r, 's' complex on split arrays
+typedef struct {
+    char kind;
+    size_t n;
+    size_t howmany;
+    size_t idist;
+    size_t odist;
+    bfft_complex_plan *complex_plan; // n / 2 for even r2c and c2r, else n
+    bfft_complex *real_twiddles;     // exp(-2 pi i k / n), k <= n / 2
+} bfft_plan_s;
+
+typedef bfft_plan_s *bfft_plan;
+
+void *bfft_malloc(size_t size) {
+    void *p = NULL;
+    if (posix_memalign(&p, 32, size > 0 ? size : 1) != 0) {
+        return NULL;
+    }
+    return p;
+}
+
+void bfft_free(void *p) { free(p); }
+
+int bfft_alignment_of(real *p) { return (int)((uintptr_t)p % 16); }
+
+// no wisdom, nothing to import or export
+int bfft_import_wisdom_from_filename(const char *filename) {
+    (void)filename;
+    return 0;
+}
+
+int bfft_export_wisdom_to_filename(const char *filename) {
+    (void)filename;
+    return 1;
+}
+
+// exp(-2 pi i j / n), evaluated in double precision
+bfft_complex bfft_unit_root(unsigned long long j, unsigned long long n) {
+    double phase = -2.0 * 3.14159265358979323846 * (double)j / (double)n;
+    return (real)cos(phase) + I * (real)sin(phase);
+}
+
+// recursive decimation in time: the n points in[0], in[stride], ... are
+// split into p interleaved sequences of length n / p, whose transforms are
+// combined by radix p butterflies, out must not overlap in
+void bfft_mixed_radix(const bfft_complex_plan *plan, size_t stage, size_t n,
+                      const bfft_complex *in, size_t stride,
+                      bfft_complex *out) {
+    if (n == 1) {
+        out[0] = in[0];
+        return;
+    }
+    size_t p = plan->factors[stage];
+    size_t m = n / p;
+    for (size_t q = 0; q < p; q++) {
+        bfft_mixed_radix(plan, stage + 1, m, &in[q * stride], stride * p,
+                         &out[q * m]);
+    }
+
+    // twiddle exp(-2 pi i q k / n) is twiddles[q * k * tstep]
+    const bfft_complex *twiddles = plan->twiddles;
+    size_t tstep = plan->n / n;
+    size_t pstep = plan->n / p;
+    for (size_t k = 0; k < m; k++) {
+        bfft_complex t[BFFT_MAX_RADIX];
+        t[0] = out[k];
+        for (size_t q = 1; q < p; q++) {
+            t[q] = out[q * m + k] * twiddles[q * k * tstep];
+        }
+        switch (p) {
+        case 2:
+            out[k] = t[0] + t[1];
+            out[m + k] = t[0] - t[1];
+            break;
+        case 4: {
+            bfft_complex a = t[0] + t[2];
+            bfft_complex b = t[0] - t[2];
+            bfft_complex c = t[1] + t[3];
+            bfft_complex d = (t[1] - t[3]) * -I;
+            out[k] = a + c;
+            out[m + k] = b + d;
+            out[2 * m + k] = a - c;
+            out[3 * m + k] = b - d;
+            break;
+        }
+        default:
+            for (size_t r = 0; r < p; r++) {
+                bfft_complex sum = t[0];
+                for (size_t q = 1; q < p; q++) {
+                    sum += t[q] * twiddles[(q * r % p) * pstep];
+                }
+                out[r * m + k] = sum;
+            }
+        }
+    }
+}
+
+// forward transform of in[0], in[stride], ... to out (not overlapping in)
+void bfft_forward(const bfft_complex_plan *plan, const bfft_complex *in,
+                  size_t stride, bfft_complex *out) {
+    if (plan->nconv == 0) {
+        bfft_mixed_radix(plan, 0, plan->n, in, stride, out);
+        return;
+    }
+    size_t n = plan->n;
+    size_t nconv = plan->nconv;
+    bfft_complex *a = bfft_malloc(nconv * sizeof(bfft_complex));
+    bfft_complex *b = bfft_malloc(nconv * sizeof(bfft_complex));
+    for (size_t j = 0; j < n; j++) {
+        a[j] = in[j * stride] * plan->chirp[j];
+    }
+    memset(&a[n], 0, (nconv - n) * sizeof(bfft_complex));
+    bfft_mixed_radix(plan->conv_plan, 0, nconv, a, 1, b);
+    // inverse transform as conj(forward(conj(.)))
+    for (size_t k = 0; k < nconv; k++) {
+        b[k] = conj(b[k] * plan->chirp_fourier[k]);
+    }
+    bfft_mixed_radix(plan->conv_plan, 0, nconv, b, 1, a);
+    for (size_t k = 0; k < n; k++) {
+        out[k] = plan->chirp[k] * conj(a[k]) / (real)nconv;
+    }
+    bfft_free(a);
+    bfft_free(b);
+}
+
+bfft_complex_plan *bfft_make_complex_plan(size_t n) {
+    bfft_complex_plan *plan = calloc(1, sizeof(bfft_complex_plan));
+    plan->n = n;
+    plan->twiddles = bfft_malloc(n * sizeof(bfft_complex));
+    for (size_t j = 0; j < n; j++) {
+        plan->twiddles[j] = bfft_unit_root(j, n);
+    }
+    // radix 4 first, then the other prime factors ascending
+    size_t rest = n;
+    while (rest % 4 == 0) {
+        plan->factors[plan->nfactors++] = 4;
+        rest /= 4;
+    }
+    for (size_t p = 2; p * p <= rest; p++) {
+        while (rest % p == 0) {
+            plan->factors[plan->nfactors++] = p;
+            rest /= p;
+        }
+    }
+    if (rest > 1) {
+        plan->factors[plan->nfactors++] = rest;
+    }
+    if (n <= 1 || plan->factors[plan->nfactors - 1] <= BFFT_MAX_RADIX) {
+        return plan;
+    }
+
+    // Bluestein: X_k = c_k sum_j (x_j c_j) c*_{k - j} with
+    // c_j = exp(-i pi j^2 / n), a cyclic convolution of length
+    // nconv >= 2n - 1 (a power of two)
+    plan->nconv = 1;
+    while (plan->nconv < 2 * n - 1) {
+        plan->nconv *= 2;
+    }
+    plan->conv_plan = bfft_make_complex_plan(plan->nconv);
+    plan->chirp = bfft_malloc(n * sizeof(bfft_complex));
+    for (size_t j = 0; j < n; j++) {
+        plan->chirp[j] =
+            bfft_unit_root((unsigned long long)j * j % (2 * n), 2 * n);
+    }
+    bfft_complex *conj_chirp = calloc(plan->nconv, sizeof(bfft_complex));
+    conj_chirp[0] = conj(plan->chirp[0]);
+    for (size_t j = 1; j < n; j++) {
+        conj_chirp[j] = conj(plan->chirp[j]);
+        conj_chirp[plan->nconv - j] = conj(plan->chirp[j]);
+    }
+    plan->chirp_fourier = bfft_malloc(plan->nconv * sizeof(bfft_complex));
+    bfft_forward(plan->conv_plan, conj_chirp, 1, plan->chirp_fourier);
+    free(conj_chirp);
+    return plan;
+}
+
+void bfft_destroy_complex_plan(bfft_complex_plan *plan) {
+    if (plan == NULL) {
+        return;
+    }
+    bfft_free(plan->twiddles);
+    bfft_free(plan->chirp);
+    bfft_free(plan->chirp_fourier);
+    bfft_destroy_complex_plan(plan->conv_plan);
+    free(plan);
+}
+
+bfft_plan bfft_make_plan(char kind, int rank, const int *n, int howmany,
+                         int istride, int idist, int ostride, int odist) {
+    if (rank != 1 || istride != 1 || ostride != 1 || n[0] < 1) {
+        fprintf(stderr, "ERROR: bundled FFT: only one dimensional transforms "
+                        "of contiguous series are supported.\n");
+        return NULL;
+    }
+    bfft_plan plan = calloc(1, sizeof(bfft_plan_s));
+    plan->kind = kind;
+    plan->n = n[0];
+    plan->howmany = howmany;
+    plan->idist = idist;
+    plan->odist = odist;
+    // real transforms of even length as complex transforms of half length
+    bool half = kind != 's' && plan->n % 2 == 0;
+    plan->complex_plan = bfft_make_complex_plan(half ? plan->n / 2 : plan->n);
+    if (half) {
+        plan->real_twiddles =
+            bfft_malloc((plan->n / 2 + 1) * sizeof(bfft_complex));
+        for (size_t k = 0; k <= plan->n / 2; k++) {
+            plan->real_twiddles[k] = bfft_unit_root(k, plan->n);
+        }
+    }
+    return plan;
+}
+
+bfft_plan bfft_plan_many_dft_r2c(int rank, const int *n, int howmany, real *in,
+                                 const int *inembed, int istride, int idist,
+                                 bfft_complex *out, const int *onembed,
+                                 int ostride, int odist, unsigned flags) {
+    (void)in, (void)inembed, (void)out, (void)onembed, (void)flags;
+    return bfft_make_plan('r', rank, n, howmany, istride, idist, ostride,
+                          odist);
+}
+
+bfft_plan bfft_plan_many_dft_c2r(int rank, const int *n, int howmany,
+                                 bfft_complex *in, const int *inembed,
+                                 int istride, int idist, real *out,
+                                 const int *onembed, int ostride, int odist,
+                                 unsigned flags) {
+    (void)in, (void)inembed, (void)out, (void)onembed, (void)flags;
+    return bfft_make_plan('c', rank, n, howmany, istride, idist, ostride,
+                          odist);
+}
+
+// only a single transform (howmany_rank 0)
+bfft_plan bfft_plan_guru_split_dft(int rank, const bfft_iodim *dims,
+                                   int howmany_rank,
+                                   const bfft_iodim *howmany_dims, real *ri,
+                                   real *ii, real *ro, real *io,
+                                   unsigned flags) {
+    (void)howmany_dims, (void)ri, (void)ii, (void)ro, (void)io, (void)flags;
+    if (howmany_rank != 0) {
+        return NULL;
+    }
+    return bfft_make_plan('s', rank, &dims[0].n, 1, dims[0].is, 0, dims[0].os,
+                          0);
+}
+
+void bfft_destroy_plan(bfft_plan plan) {
+    bfft_destroy_complex_plan(plan->complex_plan);
+    bfft_free(plan->real_twiddles);
+    free(plan);
+}
+
+// X_k for k <= n / 2 of real series
+// even n: z_j = x_2j + i x_2j+1, X_k = E_k + w^k O_k with
+// E_k = (Z_k + Z*_{h-k}) / 2 and O_k = (Z_k - Z*_{h-k}) / 2i
+void bfft_execute_dft_r2c(const bfft_plan plan, real *in, bfft_complex *out) {
+    size_t n = plan->n;
+    size_t h = plan->real_twiddles ? n / 2 : n;
+    bfft_complex *z = bfft_malloc(2 * h * sizeof(bfft_complex));
+    bfft_complex *fourier = &z[h];
+    for (size_t s = 0; s < plan->howmany; s++) {
+        real *x = &in[s * plan->idist];
+        bfft_complex *X = &out[s * plan->odist];
+        if (plan->real_twiddles) {
+            for (size_t j = 0; j < h; j++) {
+                z[j] = x[2 * j] + I * x[2 * j + 1];
+            }
+            bfft_forward(plan->complex_plan, z, 1, fourier);
+            for (size_t k = 0; k <= h; k++) {
+                bfft_complex zk = fourier[k % h];
+                bfft_complex zc = conj(fourier[(h - k) % h]);
+                bfft_complex even = 0.5 * (zk + zc);
+                bfft_complex odd = -0.5 * I * (zk - zc);
+                X[k] = even + plan->real_twiddles[k] * odd;
+            }
+        } else {
+            for (size_t j = 0; j < n; j++) {
+                z[j] = x[j];
+            }
+            bfft_forward(plan->complex_plan, z, 1, fourier);
+            memcpy(X, fourier, (n / 2 + 1) * sizeof(bfft_complex));
+        }
+    }
+    bfft_free(z);
+}
+
+// real series of the hermitian spectrum X_k, k <= n / 2 (unnormalized
+// inverse), the imaginary parts of X_0 and X_{n/2} are ignored
+// even n: E_k and O_k from X_k and X*_{h-k}, inverse complex transform of
+// z = E + i O gives the even and odd points
+void bfft_execute_dft_c2r(const bfft_plan plan, bfft_complex *in, real *out) {
+    size_t n = plan->n;
+    size_t h = plan->real_twiddles ? n / 2 : n;
+    bfft_complex *z = bfft_malloc(2 * h * sizeof(bfft_complex));
+    bfft_complex *series = &z[h];
+    for (size_t s = 0; s < plan->howmany; s++) {
+        bfft_complex *X = &in[s * plan->idist];
+        real *x = &out[s * plan->odist];
+        // inverse transform as conj(forward(conj(.)))
+        if (plan->real_twiddles) {
+            for (size_t k = 0; k < h; k++) {
+                bfft_complex xk = k == 0 ? creal(X[0]) : X[k];
+                bfft_complex xc =
+                    k == 0 ? creal(X[h]) : conj(X[h - k]);
+                bfft_complex even = 0.5 * (xk + xc);
+                bfft_complex odd =
+                    0.5 * (xk - xc) * conj(plan->real_twiddles[k]);
+                z[k] = conj(even + I * odd);
+            }
+            bfft_forward(plan->complex_plan, z, 1, series);
+            for (size_t j = 0; j < h; j++) {
+                x[2 * j] = 2.0 * creal(series[j]);
+                x[2 * j + 1] = -2.0 * cimag(series[j]);
+            }
+        } else {
+            for (size_t k = 0; k < n; k++) {
+                z[k] = k == 0 ? creal(X[0])
+                              : (k <= n / 2 ? conj(X[k]) : X[n - k]);
+            }
+            bfft_forward(plan->complex_plan, z, 1, series);
+            for (size_t j = 0; j < n; j++) {
+                x[j] = creal(series[j]);
+            }
+        }
+    }
+    bfft_free(z);
+}
+
+void bfft_execute_split_dft(const bfft_plan plan, real *ri, real *ii, real *ro,
+                            real *io) {
+    size_t n = plan->n;
+    bfft_complex *z = bfft_malloc(2 * n * sizeof(bfft_complex));
+    for (size_t j = 0; j < n; j++) {
+        z[j] = ri[j] + I * ii[j];
+    }
+    bfft_forward(plan->complex_plan, z, 1, &z[n]);
+    for (size_t k = 0; k < n; k++) {
+        ro[k] = creal(z[n + k]);
+        io[k] = cimag(z[n + k]);
+    }
+    bfft_free(z);
+}
+
+#endif
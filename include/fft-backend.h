@@ -0,0 +1,34 @@
+#ifndef DOSCALC_FFT_BACKEND_DEF
+#define DOSCALC_FFT_BACKEND_DEF
+
+// FFT library, selected at compile time:
+// FFTW by default, the bundled FFT (USE_BUNDLED_FFT) where FFTW is not
+// available, FFT(name) is the FFTW function or type name in the working
+// precision
+#include "precision.h"
+#include <complex.h>
+
+#ifdef USE_BUNDLED_FFT
+#include "bundled-fft.h"
+#define FFT_BACKEND_NAME "bundled"
+#define FFT(name) bfft_##name
+#define FFT_MEASURE (0U)
+#define FFT_UNALIGNED (1U << 1)
+#define FFT_PATIENT (1U << 5)
+#define FFT_ESTIMATE (1U << 6)
+#else
+#include <fftw3.h>
+#define FFT_BACKEND_NAME "FFTW"
+// pasted directly, a nested macro would expand the argument complex first
+#ifdef DOUBLE_PRECISION
+#define FFT(name) fftw_##name
+#else
+#define FFT(name) fftwf_##name
+#endif
+#define FFT_MEASURE FFTW_MEASURE
+#define FFT_UNALIGNED FFTW_UNALIGNED
+#define FFT_PATIENT FFTW_PATIENT
+#define FFT_ESTIMATE FFTW_ESTIMATE
+#endif
+
+#endif
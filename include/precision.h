@@ -0,0 +1,19 @@
+#ifndef DOSCALC_PRECISION_DEF
+#define DOSCALC_PRECISION_DEF
+
+// working precision, selected at compile time:
+// dos-calc uses single precision, dos-calc-dp (DOUBLE_PRECISION) double
+// precision for data arrays, BLAS/LAPACK and FFT calls (see fft-backend.h)
+#ifdef DOUBLE_PRECISION
+typedef double real;
+#define PRECISION_NAME "double"
+#define CBLAS(name) cblas_d##name
+#define LAPACKE(name) LAPACKE_d##name
+#else
+typedef float real;
+#define PRECISION_NAME "single"
+#define CBLAS(name) cblas_s##name
+#define LAPACKE(name) LAPACKE_s##name
+#endif
+
+#endif
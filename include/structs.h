@@ -1,3 +1,5 @@
+#include "precision.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -18,6 +20,9 @@ typedef struct {
 typedef struct {
     char name[80];
     char type;
+    bool exclude_self; // "e" and "n", leave out pairs of the same molecule
+    char correlation;  // 'a' |A| |B| (default), 'r' Re(A B*)
+    real cutoff;       // "n" only, distance of the molecule centers of mass
     size_t ndof_pair_defs;
     dof_pair_def *dof_pair_defs;
 } cross_spectrum_def;
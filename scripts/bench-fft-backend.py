@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import numpy as np
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+if sys.version_info < (3, 6):
+    print("This script requires at least Python version 3.6")
+    sys.exit(1)
+
+
+def write_dosparams(dosparams, nblocksteps, outfile):
+    with open(dosparams, "r") as f:
+        params = json.load(f)
+    params["nblocksteps"] = nblocksteps
+    # one block length, keep the first partition if several are given
+    for key in ("nsamples", "nblocks"):
+        if isinstance(params[key], list):
+            params[key] = params[key][0]
+    with open(outfile, "w") as f:
+        json.dump(params, f)
+
+
+def run_dos_calc(executable, dosparams, trajectory, extra_args, outfile):
+    command = [
+        executable,
+        "--verbose",
+        *extra_args,
+        "-o",
+        outfile,
+        dosparams,
+        trajectory,
+    ]
+    result = subprocess.run(
+        command, check=True, stderr=subprocess.PIPE, universal_newlines=True
+    )
+    match = re.search(r"^fast Fourier transform: (\S+)$", result.stderr, re.M)
+    fft_time = float(match.group(1))
+    with open(outfile, "r") as f:
+        system = json.load(f)
+    return fft_time, system
+
+
+def max_deviation(system, system_ref):
+    worst = 0.0
+    spectra = []
+    for moltype, moltype_ref in zip(system["moltypes"], system_ref["moltypes"]):
+        for dos_name, dos_ref in moltype_ref["spectra"].items():
+            spectra.append((moltype["spectra"][dos_name], dos_ref))
+    for cs_name, cs_ref in system_ref["cross_spectra"].items():
+        spectra.append((system["cross_spectra"][cs_name], cs_ref))
+    for dos, dos_ref in spectra:
+        dos = np.array(dos, dtype=np.float64)
+        dos_ref = np.array(dos_ref, dtype=np.float64)
+        scale = np.max(np.abs(dos_ref))
+        if scale == 0.0:
+            scale = 1.0
+        worst = max(worst, np.max(np.abs(dos - dos_ref)) / scale)
+    return worst
+
+
+if __name__ == "__main__":
+
+    # arguemnt parser
+    parser = argparse.ArgumentParser(
+        description="Compare the time of the Fourier transform stage and the "
+        "spectra of a dos-calc built with the bundled FFT "
+        "(-DUSE_BUNDLED_FFT=ON) with one built with FFTW, for several block "
+        "lengths. Further arguments after -- are passed to dos-calc."
+    )
+    parser.add_argument("dosparams", help="dosparams file")
+    parser.add_argument("trajectory", help="trajectory file")
+    parser.add_argument(
+        "--fftw-exe",
+        help="dos-calc executable built with FFTW",
+        dest="fftw_exe",
+        default="dos-calc",
+    )
+    parser.add_argument(
+        "--bundled-exe",
+        help="dos-calc executable built with the bundled FFT",
+        dest="bundled_exe",
+        required=True,
+    )
+    parser.add_argument(
+        "--nblocksteps",
+        help="block lengths to compare (the trajectory needs enough frames)",
+        dest="nblocksteps",
+        nargs="+",
+        type=int,
+        default=[500, 1000, 2000, 4999, 5000, 10000],
+    )
+    parser.add_argument("extra_args", nargs=argparse.REMAINDER)
+
+    args = parser.parse_args()
+    extra_args = [arg for arg in args.extra_args if arg != "--"]
+
+    print("nblocksteps   FFTW time   bundled time   ratio   max. deviation")
+    with tempfile.TemporaryDirectory() as tmpdir:
+        for nblocksteps in args.nblocksteps:
+            dosparams = os.path.join(tmpdir, f"params-{nblocksteps}.json")
+            write_dosparams(args.dosparams, nblocksteps, dosparams)
+            fftw_time, system_ref = run_dos_calc(
+                args.fftw_exe,
+                dosparams,
+                args.trajectory,
+                extra_args,
+                os.path.join(tmpdir, f"dos-fftw-{nblocksteps}.json"),
+            )
+            bundled_time, system = run_dos_calc(
+                args.bundled_exe,
+                dosparams,
+                args.trajectory,
+                extra_args,
+                os.path.join(tmpdir, f"dos-bundled-{nblocksteps}.json"),
+            )
+            print(
+                f"{nblocksteps:11d} {fftw_time:9.3f} s {bundled_time:12.3f} s"
+                f" {bundled_time / fftw_time:7.2f}"
+                f"   {max_deviation(system, system_ref):.3E}"
+            )
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import numpy as np
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+if sys.version_info < (3, 6):
+    print("This script requires at least Python version 3.6")
+    sys.exit(1)
+
+PACKING_MODES = ["none", "xy", "atoms", "molecules"]
+
+
+def run_dos_calc(
+    executable, dosparams, trajectory, packing, extra_args, outfile
+):
+    command = [
+        executable,
+        "--verbose",
+        "--fft-packing",
+        packing,
+        *extra_args,
+        "-o",
+        outfile,
+        dosparams,
+        trajectory,
+    ]
+    result = subprocess.run(
+        command, check=True, stderr=subprocess.PIPE, universal_newlines=True
+    )
+    match = re.search(r"^fast Fourier transform: (\S+)$", result.stderr, re.M)
+    fft_time = float(match.group(1))
+    with open(outfile, "r") as f:
+        system = json.load(f)
+    return fft_time, system
+
+
+def max_deviation(system, system_ref):
+    worst = 0.0
+    spectra = []
+    for moltype, moltype_ref in zip(system["moltypes"], system_ref["moltypes"]):
+        for dos_name, dos_ref in moltype_ref["spectra"].items():
+            spectra.append((moltype["spectra"][dos_name], dos_ref))
+    for cs_name, cs_ref in system_ref["cross_spectra"].items():
+        spectra.append((system["cross_spectra"][cs_name], cs_ref))
+    for dos, dos_ref in spectra:
+        dos = np.array(dos, dtype=np.float64)
+        dos_ref = np.array(dos_ref, dtype=np.float64)
+        scale = np.max(np.abs(dos_ref))
+        if scale == 0.0:
+            scale = 1.0
+        worst = max(worst, np.max(np.abs(dos - dos_ref)) / scale)
+    return worst
+
+
+if __name__ == "__main__":
+
+    # arguemnt parser
+    parser = argparse.ArgumentParser(
+        description="Compare the time of the Fourier transform stage and the "
+        "spectra of the FFT packing modes with the unpacked (none) mode. "
+        "Further arguments after -- are passed to dos-calc."
+    )
+    parser.add_argument("dosparams", help="dosparams file")
+    parser.add_argument("trajectory", help="trajectory file")
+    parser.add_argument(
+        "--exe",
+        help="dos-calc executable",
+        dest="exe",
+        default="dos-calc",
+    )
+    parser.add_argument(
+        "--modes",
+        help="packing modes to compare",
+        dest="modes",
+        nargs="+",
+        choices=PACKING_MODES,
+        default=PACKING_MODES,
+    )
+    parser.add_argument("extra_args", nargs=argparse.REMAINDER)
+
+    args = parser.parse_args()
+    extra_args = [arg for arg in args.extra_args if arg != "--"]
+    modes = ["none"] + [mode for mode in args.modes if mode != "none"]
+
+    results = {}
+    with tempfile.TemporaryDirectory() as tmpdir:
+        for mode in modes:
+            results[mode] = run_dos_calc(
+                args.exe,
+                args.dosparams,
+                args.trajectory,
+                mode,
+                extra_args,
+                os.path.join(tmpdir, f"dos-{mode}.json"),
+            )
+
+    fft_time_ref, system_ref = results["none"]
+    print("FFT packing   FFT time   speedup   max. deviation from none")
+    for mode in modes:
+        fft_time, system = results[mode]
+        print(
+            f"{mode:12s} {fft_time:8.3f} s {fft_time_ref / fft_time:8.2f}"
+            f"   {max_deviation(system, system_ref):.3E}"
+        )
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import numpy as np
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+if sys.version_info < (3, 6):
+    print("This script requires at least Python version 3.6")
+    sys.exit(1)
+
+
+def run_dos_calc(executable, dosparams, trajectory, extra_args, outfile):
+    command = [executable, *extra_args, "-o", outfile, dosparams, trajectory]
+    begin = time.perf_counter()
+    subprocess.run(command, check=True)
+    runtime = time.perf_counter() - begin
+    with open(outfile, "r") as f:
+        system = json.load(f)
+    return runtime, system
+
+
+def _integral(freq, dos):
+    if len(freq) == 1:
+        return np.mean(dos)
+    else:
+        return np.trapz(np.mean(dos, axis=0), x=freq)
+
+
+def compare_spectra(name, freq, dos_sp, dos_dp):
+    dos_sp = np.array(dos_sp, dtype=np.float64)
+    dos_dp = np.array(dos_dp, dtype=np.float64)
+    scale = np.max(np.abs(dos_dp))
+    if scale == 0.0:
+        scale = 1.0
+    max_deviation = np.max(np.abs(dos_sp - dos_dp)) / scale
+    integral_sp = _integral(freq, dos_sp)
+    integral_dp = _integral(freq, dos_dp)
+    if integral_dp == 0.0:
+        integral_deviation = abs(integral_sp)
+    else:
+        integral_deviation = abs(integral_sp - integral_dp) / abs(integral_dp)
+    print(
+        f"{name:24s} max. deviation: {max_deviation:.3E}"
+        f"   integral deviation: {integral_deviation:.3E}"
+    )
+    return max_deviation
+
+
+def compare_systems(system_sp, system_dp):
+    freq = np.array(system_dp["frequencies"])
+    worst = 0.0
+    for h, (moltype_sp, moltype_dp) in enumerate(
+        zip(system_sp["moltypes"], system_dp["moltypes"])
+    ):
+        for dos_name, dos_dp in moltype_dp["spectra"].items():
+            dos_sp = moltype_sp["spectra"][dos_name]
+            worst = max(
+                worst, compare_spectra(f"{h} {dos_name}", freq, dos_sp, dos_dp)
+            )
+    for cs_name, cs_dp in system_dp["cross_spectra"].items():
+        cs_sp = system_sp["cross_spectra"][cs_name]
+        worst = max(worst, compare_spectra(cs_name, freq, cs_sp, cs_dp))
+    return worst
+
+
+if __name__ == "__main__":
+
+    # arguemnt parser
+    parser = argparse.ArgumentParser(
+        description="Compare speed and spectra of single (dos-calc) and "
+        "double precision (dos-calc-dp) runs on the same input. Further "
+        "arguments after -- are passed to dos-calc."
+    )
+    parser.add_argument("dosparams", help="dosparams file")
+    parser.add_argument("trajectory", help="trajectory file")
+    parser.add_argument(
+        "--sp",
+        help="single precision executable",
+        dest="sp",
+        default="dos-calc",
+    )
+    parser.add_argument(
+        "--dp",
+        help="double precision executable",
+        dest="dp",
+        default="dos-calc-dp",
+    )
+    parser.add_argument("extra_args", nargs=argparse.REMAINDER)
+
+    args = parser.parse_args()
+    extra_args = [arg for arg in args.extra_args if arg != "--"]
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        runtime_sp, system_sp = run_dos_calc(
+            args.sp,
+            args.dosparams,
+            args.trajectory,
+            extra_args,
+            os.path.join(tmpdir, "dos-sp.json"),
+        )
+        runtime_dp, system_dp = run_dos_calc(
+            args.dp,
+            args.dosparams,
+            args.trajectory,
+            extra_args,
+            os.path.join(tmpdir, "dos-dp.json"),
+        )
+
+    print(f"runtime single precision: {runtime_sp:.2f} s")
+    print(f"runtime double precision: {runtime_dp:.2f} s")
+    print(f"speedup of single precision: {runtime_dp / runtime_sp:.2f}")
+    print("deviation of single from double precision (relative to maximum):")
+    worst = compare_systems(system_sp, system_dp)
+    print(f"largest deviation: {worst:.3E}")
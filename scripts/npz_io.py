@@ -0,0 +1,60 @@
+"""Memory-mapped reading of the npz files written by dos-calc (dos.npz and
+block stores), shared by the scripts in this folder."""
+
+import json
+import numpy as np
+import struct
+import zipfile
+
+
+def _memmap_npy_member(filename, info):
+    # members written by dos-calc are stored uncompressed, the array follows
+    # the zip local header and the .npy header
+    with open(filename, "rb") as f:
+        f.seek(info.header_offset)
+        local_header = f.read(30)
+        name_length, extra_length = struct.unpack("<HH", local_header[26:30])
+        f.seek(info.header_offset + 30 + name_length + extra_length)
+        version = np.lib.format.read_magic(f)
+        if version == (1, 0):
+            shape, fortran_order, dtype = np.lib.format.read_array_header_1_0(f)
+        else:
+            shape, fortran_order, dtype = np.lib.format.read_array_header_2_0(f)
+        return np.memmap(
+            filename,
+            dtype=dtype,
+            mode="r",
+            shape=shape,
+            order="F" if fortran_order else "C",
+            offset=f.tell(),
+        )
+
+
+def load_npz_section(filename, resolution=0):
+    # metadata and arrays of one block length (prefix resolution<r>/ if there
+    # are several), uncompressed arrays are memory-mapped
+    with zipfile.ZipFile(filename) as archive:
+        prefixes = sorted(
+            (
+                name[: -len("metadata.json")]
+                for name in archive.namelist()
+                if name.endswith("metadata.json")
+            ),
+            key=lambda prefix: (len(prefix), prefix),
+        )
+        prefix = prefixes[resolution]
+        metadata = json.loads(archive.read(prefix + "metadata.json"))
+        arrays = {}
+        for info in archive.infolist():
+            key = info.filename[len(prefix) : -len(".npy")]
+            if (
+                not info.filename.startswith(prefix)
+                or not info.filename.endswith(".npy")
+                or "/" in key
+            ):
+                continue
+            if info.compress_type == zipfile.ZIP_STORED:
+                arrays[key] = _memmap_npy_member(filename, info)
+            else:
+                arrays[key] = np.load(filename)[prefix + key]
+    return metadata, arrays
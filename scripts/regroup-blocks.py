@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import numpy as np
+import sys
+import zipfile
+from npz_io import load_npz_section
+
+if sys.version_info < (3, 6):
+    print("This script requires at least Python version 3.6")
+    sys.exit(1)
+
+
+def groups_of_samples(metadata, nblocks=None):
+    # consecutive groups of nblocks blocks, by default the samples of the run
+    nstored = len(metadata["blocks_sample"])
+    if nblocks is None:
+        samples = np.array(metadata["blocks_sample"])
+        return [
+            np.flatnonzero(samples == sample) for sample in np.unique(samples)
+        ]
+    return [
+        np.arange(first, first + nblocks)
+        for first in range(0, nstored - nblocks + 1, nblocks)
+    ]
+
+
+def groups_of_window(metadata, window, step):
+    # sliding window of window blocks, moved by step blocks
+    nstored = len(metadata["blocks_sample"])
+    return [
+        np.arange(first, first + window)
+        for first in range(0, nstored - window + 1, step)
+    ]
+
+
+def groups_of_bootstrap(metadata, nsamples, seed):
+    # samples of randomly drawn blocks (with replacement), as many as stored
+    nstored = len(metadata["blocks_sample"])
+    rng = np.random.default_rng(seed)
+    return [rng.integers(0, nstored, nstored) for sample in range(nsamples)]
+
+
+def regroup(metadata, arrays, groups):
+    # normalized results of the samples given by groups of block indices,
+    # the same arrays as in dos.npz
+    spectra_norm = np.array(metadata["spectra_norm"])
+    moments_norm = np.array(metadata["moments_norm"])
+
+    def mean_blocks(array):
+        # [sample][...] mean over the blocks of each group
+        return np.stack([np.mean(array[group], axis=0) for group in groups])
+
+    spectra = mean_blocks(arrays["spectra"]) * spectra_norm[None, :, None, None]
+    cross_spectra = mean_blocks(arrays["cross_spectra"])
+    cross_spectra *= metadata["cross_spectra_norm"]
+    moi = mean_blocks(arrays["moments_of_inertia"]) * moments_norm[None, :, None]
+    moi_squared = mean_blocks(arrays["moments_of_inertia_squared"])
+    moi_squared *= moments_norm[None, :, None]
+    coriolis = mean_blocks(arrays["coriolis"]) * moments_norm[None, :]
+
+    # moltypes (and cross spectra) as first axis like dos.npz
+    return {
+        "frequencies": np.asarray(arrays["frequencies"]),
+        "spectra": np.ascontiguousarray(np.moveaxis(spectra, 0, 2)),
+        "moments_of_inertia": np.ascontiguousarray(np.moveaxis(moi, 0, 1)),
+        "moments_of_inertia_std": np.ascontiguousarray(
+            np.moveaxis(np.sqrt(np.maximum(moi_squared - moi ** 2, 0)), 0, 1)
+        ),
+        "coriolis": np.ascontiguousarray(coriolis.T),
+        "cross_spectra": np.ascontiguousarray(np.moveaxis(cross_spectra, 0, 1)),
+    }
+
+
+def write_npz(filename, metadata, groups, results):
+    # uncompressed, so that show-dos.py can memory-map it
+    first_frames = np.array(metadata["blocks_first_frame"])
+    dos_metadata = {
+        key: metadata[key]
+        for key in [
+            "precision",
+            "nblocksteps",
+            "dos_names",
+            "cross_spectra_names",
+            "nmols",
+            "nmols_subsampled",
+        ]
+    }
+    dos_metadata["nblocks_used"] = [len(group) for group in groups]
+    dos_metadata["samples_first_frame"] = [
+        int(first_frames[group].min()) for group in groups
+    ]
+    with zipfile.ZipFile(filename, "w", zipfile.ZIP_STORED) as archive:
+        archive.writestr("metadata.json", json.dumps(dos_metadata))
+        for name, array in results.items():
+            with archive.open(name + ".npy", "w", force_zip64=True) as f:
+                np.lib.format.write_array(f, array)
+
+
+if __name__ == "__main__":
+
+    # argument parser
+    parser = argparse.ArgumentParser(
+        description="Regroup the blocks of a block store (dos-calc "
+        "--block-store) into samples and write them like dos.npz."
+    )
+    parser.add_argument("store", help="block store written by dos-calc")
+    parser.add_argument(
+        "-o",
+        "--outfile",
+        help="output file (npz, read by show-dos.py)",
+        default="dos-regrouped.npz",
+    )
+    parser.add_argument(
+        "-r",
+        "--resolution",
+        help="block length to regroup if there are several (index)",
+        type=int,
+        default=0,
+    )
+    subparsers = parser.add_subparsers(dest="grouping")
+    subparsers.required = True
+    samples_parser = subparsers.add_parser(
+        "samples",
+        help="consecutive samples of NBLOCKS blocks (default: as in the run)",
+    )
+    samples_parser.add_argument("-n", "--nblocks", type=int, default=None)
+    sliding_parser = subparsers.add_parser(
+        "sliding", help="time-resolved: a sample every STEP blocks of WINDOW blocks"
+    )
+    sliding_parser.add_argument("-w", "--window", type=int, required=True)
+    sliding_parser.add_argument("-s", "--step", type=int, default=1)
+    subparsers.add_parser("spectrogram", help="every block as its own sample")
+    bootstrap_parser = subparsers.add_parser(
+        "bootstrap", help="NSAMPLES samples of blocks drawn with replacement"
+    )
+    bootstrap_parser.add_argument("-n", "--nsamples", type=int, default=100)
+    bootstrap_parser.add_argument("--seed", type=int, default=1)
+
+    args = parser.parse_args()
+    metadata, arrays = load_npz_section(args.store, args.resolution)
+    if args.grouping == "samples":
+        groups = groups_of_samples(metadata, args.nblocks)
+    elif args.grouping == "sliding":
+        groups = groups_of_window(metadata, args.window, args.step)
+    elif args.grouping == "spectrogram":
+        groups = groups_of_window(metadata, 1, 1)
+    else:
+        groups = groups_of_bootstrap(metadata, args.nsamples, args.seed)
+    if len(groups) == 0:
+        print("Not enough blocks stored for a single sample.")
+        sys.exit(1)
+    results = regroup(metadata, arrays, groups)
+    write_npz(args.outfile, metadata, groups, results)
+    print(f"{len(groups)} samples written to {args.outfile}")
@@ -5,12 +5,44 @@ import json
 import matplotlib.pyplot as plt
 import numpy as np
 import sys
+from npz_io import load_npz_section
 
 if sys.version_info < (3, 6):
     print("This script requires at least Python version 3.6")
     sys.exit(1)
 
 
+def load_npz(filename, resolution=0):
+    # same structure as dos.json, the arrays are memory-mapped
+    metadata, arrays = load_npz_section(filename, resolution)
+
+    system = {
+        key: metadata[key]
+        for key in ["precision", "nblocksteps", "nblocks_used"]
+        if key in metadata
+    }
+    system["frequencies"] = arrays["frequencies"]
+    system["moltypes"] = []
+    for h in range(len(metadata["nmols"])):
+        moltype = {
+            "spectra": {
+                dos_name: arrays["spectra"][h, d]
+                for d, dos_name in enumerate(metadata["dos_names"])
+            },
+            "moments_of_inertia": arrays["moments_of_inertia"][h],
+            "moments_of_inertia_std": arrays["moments_of_inertia_std"][h],
+            "coriolis": arrays["coriolis"][h],
+        }
+        if metadata["nmols_subsampled"][h] < metadata["nmols"][h]:
+            moltype["nmols_subsampled"] = metadata["nmols_subsampled"][h]
+        system["moltypes"].append(moltype)
+    system["cross_spectra"] = {
+        cs_name: arrays["cross_spectra"][d]
+        for d, cs_name in enumerate(metadata["cross_spectra_names"])
+    }
+    return system
+
+
 def create_nocomp_spectra(system):
     # definitions
     dos_nocomp_dict = {
@@ -206,10 +238,17 @@ if __name__ == "__main__":
     parser.add_argument(
         "filename",
         nargs="?",
-        help="file to plot DoS from",
-        type=argparse.FileType("r"),
+        help="file to plot DoS from (dos.json or dos.npz)",
         default="dos.json",
     )
+    parser.add_argument(
+        "-r",
+        "--resolution",
+        help="block length to show if there are several (index)",
+        dest="resolution",
+        type=int,
+        default=0,
+    )
     parser.add_argument(
         "-c",
         "--components",
@@ -240,7 +279,13 @@ if __name__ == "__main__":
     )
 
     args = parser.parse_args()
-    system = json.load(args.filename)
+    if args.filename.endswith(".npz"):
+        system = load_npz(args.filename, args.resolution)
+    else:
+        with open(args.filename) as f:
+            system = json.load(f)
+        if "resolutions" in system:
+            system = system["resolutions"][args.resolution]
     create_nocomp_spectra(system)
     plot_spectra(
         system,
@@ -0,0 +1,133 @@
+#include "precision.h"
+#include "verbPrintf.c"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef BLOCK_LENGTH_DEF
+#define BLOCK_LENGTH_DEF
+
+// largest prime factor FFTW handles with its fast codelets
+#define FFT_MAX_SMOOTH_FACTOR 7
+
+// prime factors of n in ascending order, returns their number (at most 64)
+size_t factorize(unsigned long n, unsigned long *factors) { // output
+    size_t nfactors = 0;
+    for (unsigned long p = 2; p * p <= n; p++) {
+        while (n % p == 0) {
+            factors[nfactors++] = p;
+            n /= p;
+        }
+    }
+    if (n > 1) {
+        factors[nfactors++] = n;
+    }
+    return nfactors;
+}
+
+unsigned long largest_prime_factor(unsigned long n) {
+    unsigned long factors[64];
+    size_t nfactors = factorize(n, factors);
+    return nfactors > 0 ? factors[nfactors - 1] : 1;
+}
+
+bool is_fft_smooth(unsigned long n) {
+    return largest_prime_factor(n) <= FFT_MAX_SMOOTH_FACTOR;
+}
+
+// rough operation count of a complex FFT of length n
+// every radix-p pass costs about p operations per point, a large prime p is
+// done by Rader's algorithm as a cyclic convolution of length p - 1 (two
+// FFTs of length p - 1)
+real estimate_fft_cost(unsigned long n) {
+    if (n <= 1) {
+        return 0.0;
+    }
+    unsigned long factors[64];
+    size_t nfactors = factorize(n, factors);
+    real cost_per_point = 0.0;
+    for (size_t f = 0; f < nfactors; f++) {
+        unsigned long p = factors[f];
+        if (p <= FFT_MAX_SMOOTH_FACTOR) {
+            cost_per_point += p;
+        } else {
+            cost_per_point += 2.0 * estimate_fft_cost(p - 1) / (p - 1) + 2.0;
+        }
+    }
+    return n * cost_per_point;
+}
+
+// next FFT-friendly length (2^a 3^b 5^c 7^d) at or above n
+unsigned long next_fft_smooth(unsigned long n) {
+    while (!is_fft_smooth(n)) {
+        n++;
+    }
+    return n;
+}
+
+// previous FFT-friendly length at or below n
+unsigned long previous_fft_smooth(unsigned long n) {
+    while (n > 1 && !is_fft_smooth(n)) {
+        n--;
+    }
+    return n;
+}
+
+// choose the FFT length for series of nfftsteps frames and report the choice
+// without zero_pad the length stays nfftsteps, a length with large prime
+// factors gives a warning with the nearest FFT-friendly nblocksteps
+// (decimation frames per FFT frame)
+unsigned long plan_fft_length(unsigned long nfftsteps,
+                              unsigned long decimation, bool zero_pad,
+                              bool verbosity) {
+    unsigned long factors[64];
+    size_t nfactors = factorize(nfftsteps, factors);
+    verbPrintf(verbosity, "FFT length %lu =", nfftsteps);
+    for (size_t f = 0; f < nfactors; f++) {
+        verbPrintf(verbosity, "%s%lu", f > 0 ? " * " : " ", factors[f]);
+    }
+    verbPrintf(verbosity, ", estimated cost %.3g\n",
+               estimate_fft_cost(nfftsteps));
+    if (is_fft_smooth(nfftsteps)) {
+        verbPrintf(verbosity, "FFT length %lu kept (FFT-friendly)\n",
+                   nfftsteps);
+        return nfftsteps;
+    }
+
+    unsigned long next = next_fft_smooth(nfftsteps);
+    if (zero_pad) {
+        verbPrintf(verbosity,
+                   "FFT length %lu zero padded to %lu, estimated cost %.3g\n",
+                   nfftsteps, next, estimate_fft_cost(next));
+        return next;
+    }
+
+    unsigned long previous = previous_fft_smooth(nfftsteps);
+    unsigned long nearest =
+        next - nfftsteps <= nfftsteps - previous ? next : previous;
+    fprintf(stderr,
+            "WARNING: FFT length %lu has the prime factor %lu, nblocksteps "
+            "%lu (estimated cost %.3g instead of %.3g) or --zero-pad would "
+            "be faster\n",
+            nfftsteps, factors[nfactors - 1], nearest * decimation,
+            estimate_fft_cost(nearest), estimate_fft_cost(nfftsteps));
+    verbPrintf(verbosity, "FFT length %lu kept (not FFT-friendly)\n",
+               nfftsteps);
+    return nfftsteps;
+}
+
+// append zeros to nseries series of nfftsteps points up to npadded points
+// in place, series has room for nseries * npadded points
+void pad_series(size_t nseries, unsigned long nfftsteps, unsigned long npadded,
+                real *series) {
+    // from the last series, so that no series is overwritten before it moved
+    for (size_t s = nseries; s-- > 0;) {
+        memmove(&series[s * npadded], &series[s * nfftsteps],
+                nfftsteps * sizeof(real));
+        memset(&series[s * npadded + nfftsteps], 0,
+               (npadded - nfftsteps) * sizeof(real));
+    }
+}
+
+#endif
@@ -0,0 +1,269 @@
+#include "block-length.c"
+#include "cross-spectra.c"
+#include "decimation.c"
+#include "precision.h"
+#include "verbPrintf.c"
+#include "window.c"
+#include <cblas.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#ifndef BLOCK_RESOLUTION_DEF
+#define BLOCK_RESOLUTION_DEF
+
+// decomposed series kept for every frame of a block: trn and omega (3 per
+// molecule), vib, rot and vibc (3 per atom), moments of inertia and their
+// squares (3 per molecule) and the Coriolis term (1 per molecule)
+#define NBLOCK_SERIES 8
+
+// spectra of one block length, all block lengths are filled from the same
+// stream of decomposed frames
+typedef struct {
+    size_t nsamples;
+    size_t nblocks;
+    unsigned long nblocksteps;
+    unsigned long noverlapsteps; // frames shared by consecutive blocks
+    unsigned long nhopsteps;     // new frames per block
+    unsigned long nfftsteps;     // frames after decimation
+    unsigned long nfftpoints;    // FFT length (zero padded)
+    unsigned long nfrequencies;
+    unsigned long nfrequencies_retained;
+    real *window_weights;
+    real window_power;
+    cross_spectra_plan cross_plan;
+    // decomposed series of the current block, nfilled frames so far
+    real *block_series[NBLOCK_SERIES];
+    // the first 5 series decimated, windowed and padded to nfftpoints for
+    // the FFT, NULL if the block series are transformed as they are
+    real *fft_series[5];
+    unsigned long nfilled;
+    size_t sample;
+    size_t block;
+    // blocks used per sample (fewer than nblocks if converged early) and
+    // the integrated spectra of the current sample after the last block
+    size_t *samples_nblocks;
+    real *dos_integrals;
+    // moi/coriolis of mols (current sample)
+    real *mol_moments_of_inertia;
+    real *mol_moments_of_inertia_squared;
+    real *mol_coriolis;
+    // output
+    real *moltypes_dos_samples;
+    real *moltypes_dos_m2_samples; // only with subsampled moltypes
+    real *moltypes_dos_std_error_samples;
+    real *cross_spectra_samples;
+    real *moltypes_samples_moments_of_inertia;
+    real *moltypes_samples_moments_of_inertia_squared;
+    real *moltypes_samples_moments_of_inertia_std;
+    real *moltypes_samples_coriolis;
+    unsigned long nlags;
+    real *moltypes_correlation_samples;
+    real *cross_correlation_samples;
+} block_resolution;
+
+// block and FFT lengths, window and buffers of one block length
+// the output arrays are allocated by the caller
+void init_block_resolution(size_t nsamples, size_t nblocks,
+                           unsigned long nblocksteps, real block_overlap,
+                           char window, unsigned long decimation,
+                           real fft_framelength, real max_frequency,
+                           bool zero_pad, bool linear_correlations,
+                           size_t nmols, size_t nspectra, size_t *nseries,
+                           bool verbosity,
+                           block_resolution *res) { // output
+    res->nsamples = nsamples;
+    res->nblocks = nblocks;
+    res->nblocksteps = nblocksteps;
+    verbPrintf(verbosity, "block length %lu\n", nblocksteps);
+
+    // consecutive blocks of a sample overlap by noverlapsteps frames, the
+    // frames they share stay in the block buffers
+    res->noverlapsteps = (unsigned long)round(block_overlap * nblocksteps);
+    res->noverlapsteps = res->noverlapsteps < nblocksteps
+                             ? res->noverlapsteps
+                             : nblocksteps - 1;
+    res->nhopsteps = nblocksteps - res->noverlapsteps;
+    verbPrintf(verbosity, "blocks overlap by %lu frames, %lu frames per "
+                          "sample\n",
+               res->noverlapsteps,
+               (nblocks - 1) * res->nhopsteps + nblocksteps);
+
+    // window of the nfftsteps frames before the FFT, the spectra are
+    // divided by its mean square
+    res->nfftsteps = nblocksteps / decimation;
+    if (res->nfftsteps < MIN_DECIMATED_STEPS && decimation > 1) {
+        fprintf(stderr,
+                "ERROR: nblocksteps %lu leaves %lu frames after decimation by "
+                "%lu for max_frequency %g, at least %d are needed. Use longer "
+                "blocks or a higher max_frequency.\n",
+                nblocksteps, res->nfftsteps, decimation,
+                (double)max_frequency, MIN_DECIMATED_STEPS);
+        exit(1);
+    }
+    res->window_weights = malloc(res->nfftsteps * sizeof(real));
+    calc_window(window, res->nfftsteps, res->window_weights);
+    res->window_power = calc_window_power(res->nfftsteps, res->window_weights);
+
+    // the series of nfftsteps frames are zero padded to nfftpoints if
+    // requested, this only refines the frequency grid
+    res->nfftpoints =
+        plan_fft_length(res->nfftsteps, decimation, zero_pad, verbosity);
+    // linear correlations need at least 2 * nfftsteps - 1 points
+    if (linear_correlations && res->nfftpoints < 2 * res->nfftsteps - 1) {
+        res->nfftpoints = next_fft_smooth(2 * res->nfftsteps - 1);
+        verbPrintf(verbosity,
+                   "FFT length zero padded to %lu for linear correlations\n",
+                   res->nfftpoints);
+    }
+    res->nfrequencies = res->nfftpoints / 2 + 1;
+    res->nfrequencies_retained = calc_nfrequencies_retained(
+        res->nfftpoints, res->nfrequencies, fft_framelength, max_frequency);
+    verbPrintf(verbosity, "frequencies written: %lu\n",
+               res->nfrequencies_retained);
+
+    for (size_t s = 0; s < NBLOCK_SERIES; s++) {
+        res->block_series[s] = calloc(nseries[s] * nblocksteps, sizeof(real));
+    }
+    bool prepare = decimation > 1 || window != 'r' ||
+                   res->nfftpoints > res->nfftsteps;
+    for (size_t s = 0; s < 5; s++) {
+        res->fft_series[s] =
+            prepare ? calloc(nseries[s] * res->nfftpoints, sizeof(real))
+                    : NULL;
+    }
+    res->nfilled = 0;
+    res->sample = 0;
+    res->block = 0;
+    res->samples_nblocks = calloc(nsamples, sizeof(size_t));
+    res->dos_integrals = calloc(nspectra, sizeof(real));
+    res->mol_moments_of_inertia = calloc(nmols * 3, sizeof(real));
+    res->mol_moments_of_inertia_squared = calloc(nmols * 3, sizeof(real));
+    res->mol_coriolis = calloc(nmols, sizeof(real));
+    res->moltypes_dos_m2_samples = NULL;
+    res->moltypes_dos_std_error_samples = NULL;
+    res->nlags = 0;
+    res->moltypes_correlation_samples = NULL;
+    res->cross_correlation_samples = NULL;
+}
+
+void free_block_resolution(block_resolution *res) {
+    free(res->window_weights);
+    free_cross_spectra_plan(&res->cross_plan);
+    for (size_t s = 0; s < NBLOCK_SERIES; s++) {
+        free(res->block_series[s]);
+    }
+    for (size_t s = 0; s < 5; s++) {
+        free(res->fft_series[s]);
+    }
+    free(res->samples_nblocks);
+    free(res->dos_integrals);
+    free(res->mol_moments_of_inertia);
+    free(res->mol_moments_of_inertia_squared);
+    free(res->mol_coriolis);
+    free(res->moltypes_dos_samples);
+    free(res->moltypes_dos_m2_samples);
+    free(res->moltypes_dos_std_error_samples);
+    free(res->cross_spectra_samples);
+    free(res->moltypes_samples_moments_of_inertia);
+    free(res->moltypes_samples_moments_of_inertia_squared);
+    free(res->moltypes_samples_moments_of_inertia_std);
+    free(res->moltypes_samples_coriolis);
+    free(res->moltypes_correlation_samples);
+    free(res->cross_correlation_samples);
+}
+
+// frames of the trajectory used by all samples of this block length
+unsigned long block_resolution_nframes(block_resolution *res) {
+    return res->nsamples *
+           ((res->nblocks - 1) * res->nhopsteps + res->nblocksteps);
+}
+
+bool block_resolution_done(block_resolution *res) {
+    return res->sample == res->nsamples;
+}
+
+// append frames first.. of the decomposed chunk of nchunksteps frames to the
+// block buffers, until the block is full, returns the number of frames taken
+unsigned long append_block_frames(block_resolution *res, size_t *nseries,
+                                  unsigned long nchunksteps,
+                                  real **chunk_series, unsigned long first) {
+    unsigned long nframes = nchunksteps - first;
+    if (nframes > res->nblocksteps - res->nfilled) {
+        nframes = res->nblocksteps - res->nfilled;
+    }
+    for (size_t s = 0; s < NBLOCK_SERIES; s++) {
+        for (size_t i = 0; i < nseries[s]; i++) {
+            memcpy(&res->block_series[s][i * res->nblocksteps + res->nfilled],
+                   &chunk_series[s][i * nchunksteps + first],
+                   nframes * sizeof(real));
+        }
+    }
+    res->nfilled += nframes;
+    return nframes;
+}
+
+// divide the spectra accumulated over the blocks of each sample by its
+// number of blocks, spectra_samples is [nspectra][nsamples][n]
+void average_sample_blocks(block_resolution *res, size_t nspectra,
+                           unsigned long n, real *spectra_samples) {
+    for (size_t s = 0; s < nspectra; s++) {
+        for (size_t sample = 0; sample < res->nsamples; sample++) {
+            CBLAS(scal)(n, 1.0 / (real)res->samples_nblocks[sample],
+                        &spectra_samples[(s * res->nsamples + sample) * n],
+                        1);
+        }
+    }
+}
+
+// whether the integrated spectra of the current sample (mean over its blocks
+// so far) changed by less than tolerance (relative) with the last block,
+// for each of the nspectra spectra of n values in spectra_samples
+// ([nspectra][nsamples][n]), spectra that integrate to zero are ignored
+bool block_resolution_converged(block_resolution *res, size_t nspectra,
+                                unsigned long n, real *spectra_samples,
+                                real tolerance) {
+    bool converged = res->block > 0;
+    for (size_t s = 0; s < nspectra; s++) {
+        real *spectrum =
+            &spectra_samples[s * res->nsamples * n + res->sample * n];
+        real integral = 0.0;
+        for (unsigned long k = 0; k < n; k++) {
+            integral += spectrum[k];
+        }
+        integral /= (real)(res->block + 1);
+        real change = fabs(integral - res->dos_integrals[s]);
+        if (integral != 0.0 && change > tolerance * fabs(integral)) {
+            converged = false;
+        }
+        res->dos_integrals[s] = integral;
+    }
+    return converged;
+}
+
+// after a full block: the next block of the sample starts with the last
+// noverlapsteps frames of this one, the next sample (after nblocks blocks or
+// if end_sample) with an empty buffer
+void next_block(block_resolution *res, size_t *nseries, bool end_sample) {
+    res->block++;
+    if (res->block == res->nblocks || end_sample) {
+        res->samples_nblocks[res->sample] = res->block;
+        res->block = 0;
+        res->sample++;
+        res->nfilled = 0;
+        return;
+    }
+    for (size_t s = 0; s < NBLOCK_SERIES; s++) {
+        for (size_t i = 0; i < nseries[s]; i++) {
+            memmove(&res->block_series[s][i * res->nblocksteps],
+                    &res->block_series[s][i * res->nblocksteps +
+                                          res->nhopsteps],
+                    res->noverlapsteps * sizeof(real));
+        }
+    }
+    res->nfilled = res->noverlapsteps;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#include "json-writer.c"
+#include "precision.h"
+#include "structs.h"
+#include "write-npz.c"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef BLOCK_STORE_DEF
+#define BLOCK_STORE_DEF
+
+// raw spectra, moi and Coriolis sums of every block of one block length,
+// before they are summed into samples: spectra [moltype][dos][frequency]
+// and cross spectra [cross spectrum][frequency] (up to max_frequency, not
+// normalized), moi and moi squared [moltype][abc] and Coriolis [moltype]
+// (summed over the molecules and frames of the block)
+// each array is appended to a temporary file block by block and copied to
+// the npz file in the end
+#define NBLOCK_STORE_ARRAYS 5
+
+const char *block_store_names[NBLOCK_STORE_ARRAYS] = {
+    "spectra", "cross_spectra", "moments_of_inertia",
+    "moments_of_inertia_squared", "coriolis"};
+
+typedef struct {
+    size_t nblocks;
+    size_t ndims[NBLOCK_STORE_ARRAYS];
+    size_t shapes[NBLOCK_STORE_ARRAYS][3]; // of one block
+    FILE *files[NBLOCK_STORE_ARRAYS];
+    size_t *blocks_sample;
+    unsigned long *blocks_first_frame;
+} block_store;
+
+void init_block_store(size_t nmoltypes, size_t ndos, size_t ncross_spectra,
+                      unsigned long nfrequencies_retained,
+                      block_store *store) { // output
+    size_t ndims[NBLOCK_STORE_ARRAYS] = {3, 2, 2, 2, 1};
+    size_t shapes[NBLOCK_STORE_ARRAYS][3] = {
+        {nmoltypes, ndos, nfrequencies_retained},
+        {ncross_spectra, nfrequencies_retained},
+        {nmoltypes, 3},
+        {nmoltypes, 3},
+        {nmoltypes}};
+    for (size_t a = 0; a < NBLOCK_STORE_ARRAYS; a++) {
+        store->ndims[a] = ndims[a];
+        memcpy(store->shapes[a], shapes[a], sizeof(shapes[a]));
+        store->files[a] = tmpfile();
+        if (store->files[a] == NULL) {
+            fprintf(stderr, "ERROR: Could not create a temporary file for "
+                            "the block store.\n");
+            exit(1);
+        }
+    }
+    store->nblocks = 0;
+    store->blocks_sample = NULL;
+    store->blocks_first_frame = NULL;
+}
+
+void free_block_store(block_store *store) {
+    for (size_t a = 0; a < NBLOCK_STORE_ARRAYS; a++) {
+        fclose(store->files[a]);
+    }
+    free(store->blocks_sample);
+    free(store->blocks_first_frame);
+}
+
+// one block of sample starting at first_frame, the spectra have
+// nfrequencies each of which the first ones (shapes) are kept
+void block_store_append(block_store *store, size_t sample,
+                        unsigned long first_frame, unsigned long nfrequencies,
+                        real *moltypes_dos_block, real *cross_spectra_block,
+                        real *moltypes_moments_of_inertia,
+                        real *moltypes_moments_of_inertia_squared,
+                        real *moltypes_coriolis) {
+    store->blocks_sample = realloc(store->blocks_sample,
+                                   (store->nblocks + 1) * sizeof(size_t));
+    store->blocks_first_frame =
+        realloc(store->blocks_first_frame,
+                (store->nblocks + 1) * sizeof(unsigned long));
+    store->blocks_sample[store->nblocks] = sample;
+    store->blocks_first_frame[store->nblocks] = first_frame;
+    store->nblocks++;
+
+    // spectra, truncated
+    real *spectra[2] = {moltypes_dos_block, cross_spectra_block};
+    for (size_t a = 0; a < 2; a++) {
+        size_t nspectra = store->shapes[a][0];
+        if (a == 0) {
+            nspectra *= store->shapes[a][1];
+        }
+        unsigned long nretained = store->shapes[a][store->ndims[a] - 1];
+        for (size_t s = 0; s < nspectra; s++) {
+            fwrite(&spectra[a][s * nfrequencies], sizeof(real), nretained,
+                   store->files[a]);
+        }
+    }
+    size_t nmoltypes = store->shapes[2][0];
+    fwrite(moltypes_moments_of_inertia, sizeof(real), nmoltypes * 3,
+           store->files[2]);
+    fwrite(moltypes_moments_of_inertia_squared, sizeof(real), nmoltypes * 3,
+           store->files[3]);
+    fwrite(moltypes_coriolis, sizeof(real), nmoltypes, store->files[4]);
+}
+
+// arrays prefix<name>.npy with the blocks as first axis, prefixfrequencies.npy
+// and prefixmetadata.json with the block length, the sample and first frame
+// of every block (framelength apart, after skip_frames) and the factors that
+// normalize the sums like in dos.json (spectra_norm and moments_norm per
+// moltype)
+void write_block_store(npz_writer *npz, const char *prefix,
+                       block_store *store, unsigned long nblocksteps,
+                       size_t nblocks, unsigned long nfftpoints,
+                       real fft_framelength, real framelength,
+                       unsigned long long skip_frames,
+                       real spectra_norm, const char **dos_names,
+                       cross_spectrum_def *cross_spectra_def,
+                       size_t *moltypes_nmols, size_t *moltypes_nselected) {
+    char name[NPZ_MAX_NAME];
+    size_t nmoltypes = store->shapes[0][0];
+    size_t ndos = store->shapes[0][1];
+    size_t ncross_spectra = store->shapes[1][0];
+    unsigned long nfrequencies = store->shapes[0][2];
+
+    // metadata, small json
+    char *metadata;
+    size_t metadata_size;
+    json_writer writer;
+    json_open_stream(&writer, open_memstream(&metadata, &metadata_size));
+    json_begin_object(&writer, NULL);
+    json_string(&writer, "precision", PRECISION_NAME);
+    json_integer(&writer, "nblocksteps", nblocksteps);
+    json_integer(&writer, "nblocks", nblocks);
+    json_number(&writer, "framelength", framelength);
+    json_integer(&writer, "skip_frames", skip_frames);
+    json_begin_array(&writer, "dos_names");
+    for (size_t d = 0; d < ndos; d++) {
+        json_string(&writer, NULL, dos_names[d]);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "cross_spectra_names");
+    for (size_t d = 0; d < ncross_spectra; d++) {
+        json_string(&writer, NULL, cross_spectra_def[d].name);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "nmols");
+    for (size_t h = 0; h < nmoltypes; h++) {
+        json_integer(&writer, NULL, moltypes_nmols[h]);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "nmols_subsampled");
+    for (size_t h = 0; h < nmoltypes; h++) {
+        json_integer(&writer, NULL, moltypes_nselected[h]);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "spectra_norm");
+    for (size_t h = 0; h < nmoltypes; h++) {
+        json_number(&writer, NULL, spectra_norm / moltypes_nselected[h]);
+    }
+    json_end_array(&writer);
+    json_number(&writer, "cross_spectra_norm", spectra_norm);
+    json_begin_array(&writer, "moments_norm");
+    for (size_t h = 0; h < nmoltypes; h++) {
+        json_number(&writer, NULL,
+                    1.0 / (real)nblocksteps / (real)moltypes_nselected[h]);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "blocks_sample");
+    for (size_t b = 0; b < store->nblocks; b++) {
+        json_integer(&writer, NULL, store->blocks_sample[b]);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "blocks_first_frame");
+    for (size_t b = 0; b < store->nblocks; b++) {
+        json_integer(&writer, NULL, store->blocks_first_frame[b]);
+    }
+    json_end_array(&writer);
+    json_end_object(&writer);
+    if (json_close(&writer) != 0) {
+        fprintf(stderr, "ERROR: Could not write block store metadata.\n");
+        exit(1);
+    }
+    snprintf(name, NPZ_MAX_NAME, "%smetadata.json", prefix);
+    npz_write_member(npz, name, NULL, 0, metadata, metadata_size);
+    free(metadata);
+
+    real *frequencies = malloc(nfrequencies * sizeof(real));
+    for (unsigned long t = 0; t < nfrequencies; t++) {
+        frequencies[t] = t / (fft_framelength * (real)nfftpoints);
+    }
+    size_t shape[4] = {nfrequencies};
+    snprintf(name, NPZ_MAX_NAME, "%sfrequencies", prefix);
+    npz_write_array(npz, name, 1, shape, frequencies);
+    free(frequencies);
+
+    for (size_t a = 0; a < NBLOCK_STORE_ARRAYS; a++) {
+        fflush(store->files[a]);
+        shape[0] = store->nblocks;
+        memcpy(&shape[1], store->shapes[a], store->ndims[a] * sizeof(size_t));
+        snprintf(name, NPZ_MAX_NAME, "%s%s", prefix, block_store_names[a]);
+        npz_copy_array(npz, name, store->ndims[a] + 1, shape,
+                       store->files[a]);
+    }
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include "fft-backend.h"
+#include "precision.h"
+#include <complex.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef CORRELATION_DEF
+#define CORRELATION_DEF
+
+// correlation functions of nspectra accumulated (not yet normalized) power
+// or cross spectra by an inverse c2r FFT of length nfftpoints
+// for linear correlations the series were zero padded to at least twice
+// their length, every lag tau is divided by lag_weights[tau], the number of
+// frame pairs or with a window the sum of w(t) w(t + tau) (see
+// calc_window_lag_weights)
+// scale is applied to all spectra (e.g. 1 / nblocks / nmols)
+void calc_correlations(size_t nspectra, unsigned long nfftpoints,
+                       unsigned long nfrequencies, unsigned long nlags,
+                       real *lag_weights, real scale, real *spectra,
+                       real *correlations) { // output
+    if (nspectra == 0) {
+        return;
+    }
+    FFT(complex) *spectra_complex =
+        FFT(malloc)(nspectra * nfrequencies * sizeof(FFT(complex)));
+    real *correlations_full =
+        FFT(malloc)(nspectra * nfftpoints * sizeof(real));
+    int n[1] = {(int)nfftpoints};
+    FFT(plan) plan = FFT(plan_many_dft_c2r)(
+        1, n, (int)nspectra, spectra_complex, NULL, 1, (int)nfrequencies,
+        correlations_full, NULL, 1, (int)nfftpoints, FFT_ESTIMATE);
+    for (size_t s = 0; s < nspectra * nfrequencies; s++) {
+        spectra_complex[s] = spectra[s];
+    }
+    FFT(execute_dft_c2r)(plan, spectra_complex, correlations_full);
+    FFT(destroy_plan)(plan);
+
+    for (size_t s = 0; s < nspectra; s++) {
+        for (unsigned long tau = 0; tau < nlags; tau++) {
+            correlations[s * nlags + tau] =
+                correlations_full[s * nfftpoints + tau] * scale /
+                ((real)nfftpoints * lag_weights[tau]);
+        }
+    }
+    FFT(free)(spectra_complex);
+    FFT(free)(correlations_full);
+}
+
+#endif
@@ -0,0 +1,32 @@
+#include <stdbool.h>
+
+#ifndef CPU_DISPATCH_DEF
+#define CPU_DISPATCH_DEF
+
+// hot kernels marked with CPU_DISPATCH are compiled for several instruction
+// set levels, the ifunc resolver picks the best one at program start (CPUID)
+#if defined(USE_CPU_DISPATCH) && defined(__GNUC__) && defined(__x86_64__)
+#define CPU_DISPATCH_ENABLED 1
+#define CPU_DISPATCH                                                           \
+    __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define CPU_DISPATCH_ENABLED 0
+#define CPU_DISPATCH
+#endif
+
+// name of the instruction set level the CPU_DISPATCH kernels run with
+// uses the same priority as the resolver of target_clones
+const char *cpu_dispatch_level(void) {
+#if CPU_DISPATCH_ENABLED
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return "avx512f";
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+    return "default";
+#else
+    return "default (runtime dispatch disabled)";
+#endif
+}
+
+#endif
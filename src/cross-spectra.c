@@ -0,0 +1,533 @@
+#include "cpu-dispatch.c"
+#include "fft-backend.h"
+#include "neighbour-list.c"
+#include "precision.h"
+#include "structs.h"
+#include <complex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#ifndef CROSS_SPECTRA_DEF
+#define CROSS_SPECTRA_DEF
+
+// offset of a cross spectrum dof_type within the dof of a molecule
+// order of dof is: trn rot_xyz vib rot_omega vibc
+size_t dof_type_offset(size_t natomspermol, char type) {
+    if (type == 't')
+        return 0;
+    else if (type == 'r')
+        return 3;
+    else if (type == 'v')
+        return 3 + 3 * natomspermol;
+    else if (type == 'o')
+        return 3 + 6 * natomspermol;
+    else if (type == 'c')
+        return 6 + 6 * natomspermol;
+    fprintf(stderr, "ERROR: unknown cross spectrum dof_type: '%c'\n", type);
+    exit(1);
+}
+
+// number of dof of a cross spectrum dof_type
+size_t dof_type_ndof(size_t natomspermol, char type) {
+    if (type == 't' || type == 'o')
+        return 3;
+    return 3 * natomspermol;
+}
+
+// only the transforms referenced by cross spectra are kept in dof_fourier
+// every molecule of a moltype has the same dof stored, in slots
+// firstslot + i0 * nslots + dof_slot[dof]
+typedef struct {
+    size_t nslots;
+    size_t *moltypes_firstslot;
+    size_t *moltypes_nslots;
+    size_t **moltypes_dof_slot; // SIZE_MAX for dof that are not stored
+} dof_fourier_map;
+
+void calc_dof_fourier_map(size_t nmoltypes, size_t *moltype_nmols,
+                          size_t *moltype_natomspermol, size_t ncross_spectra,
+                          cross_spectrum_def *cross_spectra_def,
+                          dof_fourier_map *map) { // output
+    map->moltypes_firstslot = calloc(nmoltypes, sizeof(size_t));
+    map->moltypes_nslots = calloc(nmoltypes, sizeof(size_t));
+    map->moltypes_dof_slot = calloc(nmoltypes, sizeof(size_t *));
+    for (size_t h = 0; h < nmoltypes; h++) {
+        size_t mol_ndof = 6 + 9 * moltype_natomspermol[h];
+        map->moltypes_dof_slot[h] = malloc(mol_ndof * sizeof(size_t));
+        for (size_t dof = 0; dof < mol_ndof; dof++) {
+            map->moltypes_dof_slot[h][dof] = SIZE_MAX;
+        }
+    }
+
+    // mark referenced dof
+    for (size_t d = 0; d < ncross_spectra; d++) {
+        for (size_t p = 0; p < cross_spectra_def[d].ndof_pair_defs; p++) {
+            dof_pair_def *pair_def = &cross_spectra_def[d].dof_pair_defs[p];
+            for (size_t ab = 0; ab < 2; ab++) {
+                size_t h = ab == 0 ? pair_def->dofA_moltype
+                                   : pair_def->dofB_moltype;
+                char type = ab == 0 ? pair_def->dofA_type : pair_def->dofB_type;
+                size_t ndofs = ab == 0 ? pair_def->ndofA : pair_def->ndofB;
+                size_t *dof_list =
+                    ab == 0 ? pair_def->dofA_list : pair_def->dofB_list;
+                size_t natomspermol = moltype_natomspermol[h];
+                for (size_t n = 0; n < ndofs; n++) {
+                    if (dof_list[n] >= dof_type_ndof(natomspermol, type)) {
+                        fprintf(stderr,
+                                "ERROR: dof %zu out of range for dof_type "
+                                "'%c' in cross spectrum '%s'\n",
+                                dof_list[n], type, cross_spectra_def[d].name);
+                        exit(1);
+                    }
+                    size_t dof = dof_type_offset(natomspermol, type) +
+                                 dof_list[n];
+                    map->moltypes_dof_slot[h][dof] = 0;
+                }
+            }
+        }
+    }
+
+    // number marked dof in ascending order
+    map->nslots = 0;
+    for (size_t h = 0; h < nmoltypes; h++) {
+        size_t mol_ndof = 6 + 9 * moltype_natomspermol[h];
+        size_t nslots = 0;
+        for (size_t dof = 0; dof < mol_ndof; dof++) {
+            if (map->moltypes_dof_slot[h][dof] != SIZE_MAX) {
+                map->moltypes_dof_slot[h][dof] = nslots;
+                nslots++;
+            }
+        }
+        map->moltypes_firstslot[h] = map->nslots;
+        map->moltypes_nslots[h] = nslots;
+        map->nslots += nslots * moltype_nmols[h];
+    }
+}
+
+void free_dof_fourier_map(size_t nmoltypes, dof_fourier_map *map) {
+    for (size_t h = 0; h < nmoltypes; h++) {
+        free(map->moltypes_dof_slot[h]);
+    }
+    free(map->moltypes_dof_slot);
+    free(map->moltypes_firstslot);
+    free(map->moltypes_nslots);
+}
+
+// stored transform of dof of molecule i0 of moltype h, NULL if not stored
+FFT(complex) *stored_fourier(dof_fourier_map *map, FFT(complex) *dof_fourier,
+                              size_t fourier_stride, size_t h, size_t i0,
+                              size_t dof) {
+    size_t dof_slot = map->moltypes_dof_slot[h][dof];
+    if (dof_slot == SIZE_MAX) {
+        return NULL;
+    }
+    size_t slot = map->moltypes_firstslot[h] + i0 * map->moltypes_nslots[h] +
+                  dof_slot;
+    return &dof_fourier[slot * fourier_stride];
+}
+
+// add weight * |A B| of two fourier transforms to spectrum
+CPU_DISPATCH
+void accumulate_cross_spectrum(unsigned long nfrequencies,
+                               FFT(complex) *fourierA, FFT(complex) *fourierB,
+                               real weight, real *spectrum) {
+    for (unsigned long t = 0; t < nfrequencies; t++) {
+        real reA = creal(fourierA[t]);
+        real imA = cimag(fourierA[t]);
+        real reB = creal(fourierB[t]);
+        real imB = cimag(fourierB[t]);
+        spectrum[t] +=
+            weight * sqrt((reA * reA + imA * imA) * (reB * reB + imB * imB));
+    }
+}
+
+// add weight * Re(A B*), the real part of the cross correlation, to spectrum
+CPU_DISPATCH
+void accumulate_real_cross_spectrum(unsigned long nfrequencies,
+                                    FFT(complex) *fourierA,
+                                    FFT(complex) *fourierB, real weight,
+                                    real *spectrum) {
+    for (unsigned long t = 0; t < nfrequencies; t++) {
+        spectrum[t] += weight * (creal(fourierA[t]) * creal(fourierB[t]) +
+                                 cimag(fourierA[t]) * cimag(fourierB[t]));
+    }
+}
+
+// add |X| to magnitude_sum
+CPU_DISPATCH
+void accumulate_magnitude(unsigned long nfrequencies, FFT(complex) *fourier,
+                          real *magnitude_sum) {
+    for (unsigned long t = 0; t < nfrequencies; t++) {
+        real re = creal(fourier[t]);
+        real im = cimag(fourier[t]);
+        magnitude_sum[t] += sqrt(re * re + im * im);
+    }
+}
+
+// add X to fourier_sum
+CPU_DISPATCH
+void accumulate_fourier(unsigned long nfrequencies, FFT(complex) *fourier,
+                        FFT(complex) *fourier_sum) {
+    for (unsigned long t = 0; t < nfrequencies; t++) {
+        fourier_sum[t] += fourier[t];
+    }
+}
+
+// cross_spectra_def compiled to slots of dof_fourier (see dof_fourier_map)
+// once after parsing, so no dof index has to be found in the block loop
+// one molecule and dof pair, "i" spectra and the self terms of "e" spectra
+// (weight -1, if excluded)
+typedef struct {
+    size_t cross_spectrum;
+    size_t slotA;
+    size_t slotB;
+    real weight;
+} cross_spectrum_pair;
+
+// all molecules and dof of one dof_pair_def of an "e" spectrum
+// the sum over all pairs factorises
+// Σ_A Σ_B |X_A| |X_B| = (Σ_A |X_A|) (Σ_B |X_B|)
+// Σ_A Σ_B Re(X_A X_B*) = Re((Σ_A X_A) (Σ_B X_B)*)
+typedef struct {
+    size_t cross_spectrum;
+    size_t nslotsA;
+    size_t nslotsB;
+    size_t *slotsA;
+    size_t *slotsB;
+} cross_spectrum_factors;
+
+// one dof_pair_def of an "n" spectrum, the molecule pairs within the cutoff
+// are found once per block (see calc_cross_spectra_neighbours)
+// slot of dof d of molecule i: dof_slots[d] + i * mol_nslots
+typedef struct {
+    size_t cross_spectrum;
+    size_t moltypeA;
+    size_t moltypeB;
+    real cutoff;
+    bool exclude_self;
+    size_t ndofA;
+    size_t ndofB;
+    size_t *dof_slotsA;
+    size_t *dof_slotsB;
+    size_t mol_nslotsA;
+    size_t mol_nslotsB;
+} cross_spectrum_neighbours;
+
+typedef struct {
+    size_t ncross_spectra;
+    char *correlations;
+    size_t *ncross_contribs;
+    size_t npairs;
+    cross_spectrum_pair *pairs;
+    size_t nfactors;
+    cross_spectrum_factors *factors;
+    size_t nneighbours;
+    cross_spectrum_neighbours *neighbours;
+    size_t nneighbour_pairs; // pairs of "n" spectra of the current block
+    cross_spectrum_pair *neighbour_pairs;
+    // allocated sizes, the buffers are reused for every block
+    size_t neighbour_pairs_capacity;
+    size_t *neighbour_mol_pairs; // of one "n" spectrum
+    size_t neighbour_mol_pairs_capacity;
+} cross_spectra_plan;
+
+// slot of dof (of the given dof_type) of molecule i0 of moltype h
+// checks that the transform is stored in dof_fourier
+size_t cross_spectrum_slot(dof_fourier_map *map, size_t *moltype_natomspermol,
+                           size_t h, char type, size_t dof, size_t i0) {
+    size_t mol_dof = dof_type_offset(moltype_natomspermol[h], type) + dof;
+    size_t dof_slot = map->moltypes_dof_slot[h][mol_dof];
+    size_t slot = map->moltypes_firstslot[h] + i0 * map->moltypes_nslots[h] +
+                  dof_slot;
+    if (dof_slot == SIZE_MAX || slot >= map->nslots) {
+        fprintf(stderr,
+                "ERROR: transform of dof %zu (dof_type '%c') of moltype %zu is "
+                "not stored for the cross spectra\n",
+                dof, type, h);
+        exit(1);
+    }
+    return slot;
+}
+
+void compile_cross_spectrum_neighbours(size_t d, cross_spectrum_def *def,
+                                       dof_pair_def *pair_def,
+                                       size_t *moltype_nmols,
+                                       size_t *moltype_natomspermol,
+                                       dof_fourier_map *map,
+                                       cross_spectrum_neighbours *neighbours) {
+    size_t hA = pair_def->dofA_moltype;
+    size_t hB = pair_def->dofB_moltype;
+    neighbours->cross_spectrum = d;
+    neighbours->moltypeA = hA;
+    neighbours->moltypeB = hB;
+    neighbours->cutoff = def->cutoff;
+    neighbours->exclude_self = def->exclude_self && hA == hB;
+    neighbours->ndofA = pair_def->ndofA;
+    neighbours->ndofB = pair_def->ndofB;
+    neighbours->dof_slotsA = calloc(pair_def->ndofA, sizeof(size_t));
+    neighbours->dof_slotsB = calloc(pair_def->ndofB, sizeof(size_t));
+    neighbours->mol_nslotsA = map->moltypes_nslots[hA];
+    neighbours->mol_nslotsB = map->moltypes_nslots[hB];
+    // without molecules there are no pairs and no slots to check
+    if (moltype_nmols[hA] == 0 || moltype_nmols[hB] == 0) {
+        return;
+    }
+    for (size_t dA = 0; dA < pair_def->ndofA; dA++) {
+        neighbours->dof_slotsA[dA] = cross_spectrum_slot(
+            map, moltype_natomspermol, hA, pair_def->dofA_type,
+            pair_def->dofA_list[dA], 0);
+    }
+    for (size_t dB = 0; dB < pair_def->ndofB; dB++) {
+        neighbours->dof_slotsB[dB] = cross_spectrum_slot(
+            map, moltype_natomspermol, hB, pair_def->dofB_type,
+            pair_def->dofB_list[dB], 0);
+    }
+}
+
+void compile_cross_spectra(size_t *moltype_nmols, size_t *moltype_natomspermol,
+                           size_t ncross_spectra,
+                           cross_spectrum_def *cross_spectra_def,
+                           dof_fourier_map *map,
+                           cross_spectra_plan *plan) { // output
+    plan->ncross_spectra = ncross_spectra;
+    plan->correlations = calloc(ncross_spectra, sizeof(char));
+    plan->ncross_contribs = calloc(ncross_spectra, sizeof(size_t));
+
+    // count
+    plan->npairs = 0;
+    plan->nfactors = 0;
+    plan->nneighbours = 0;
+    plan->nneighbour_pairs = 0;
+    plan->neighbour_pairs = NULL;
+    plan->neighbour_pairs_capacity = 0;
+    plan->neighbour_mol_pairs = NULL;
+    plan->neighbour_mol_pairs_capacity = 0;
+    for (size_t d = 0; d < ncross_spectra; d++) {
+        plan->correlations[d] = cross_spectra_def[d].correlation;
+        for (size_t p = 0; p < cross_spectra_def[d].ndof_pair_defs; p++) {
+            dof_pair_def *pair_def = &cross_spectra_def[d].dof_pair_defs[p];
+            size_t nmolsA = moltype_nmols[pair_def->dofA_moltype];
+            size_t ndof_pairs = pair_def->ndofA * pair_def->ndofB;
+            if (cross_spectra_def[d].type == 'i') {
+                plan->npairs += ndof_pairs * nmolsA;
+                plan->ncross_contribs[d] += ndof_pairs * nmolsA;
+                continue;
+            }
+            // "n": the number of neighbours changes from block to block,
+            // averaged per molecule A
+            if (cross_spectra_def[d].type == 'n') {
+                plan->nneighbours++;
+                plan->ncross_contribs[d] += ndof_pairs * nmolsA;
+                continue;
+            }
+            plan->nfactors++;
+            size_t nmol_pairs = nmolsA * moltype_nmols[pair_def->dofB_moltype];
+            if (cross_spectra_def[d].exclude_self &&
+                pair_def->dofA_moltype == pair_def->dofB_moltype) {
+                plan->npairs += ndof_pairs * nmolsA;
+                nmol_pairs -= nmolsA;
+            }
+            plan->ncross_contribs[d] += ndof_pairs * nmol_pairs;
+        }
+    }
+
+    // fill
+    plan->pairs = malloc(plan->npairs * sizeof(cross_spectrum_pair));
+    plan->factors = malloc(plan->nfactors * sizeof(cross_spectrum_factors));
+    plan->neighbours =
+        malloc(plan->nneighbours * sizeof(cross_spectrum_neighbours));
+    size_t pair = 0;
+    size_t factor = 0;
+    size_t neighbour = 0;
+    for (size_t d = 0; d < ncross_spectra; d++) {
+        for (size_t p = 0; p < cross_spectra_def[d].ndof_pair_defs; p++) {
+            dof_pair_def *pair_def = &cross_spectra_def[d].dof_pair_defs[p];
+            size_t hA = pair_def->dofA_moltype;
+            size_t hB = pair_def->dofB_moltype;
+            if (cross_spectra_def[d].type == 'n') {
+                compile_cross_spectrum_neighbours(
+                    d, &cross_spectra_def[d], pair_def, moltype_nmols,
+                    moltype_natomspermol, map, &plan->neighbours[neighbour]);
+                neighbour++;
+                continue;
+            }
+            bool pairs_needed = cross_spectra_def[d].type == 'i' ||
+                                (cross_spectra_def[d].exclude_self && hA == hB);
+            real weight = cross_spectra_def[d].type == 'i' ? 1.0 : -1.0;
+            for (size_t dA = 0; dA < pair_def->ndofA && pairs_needed; dA++) {
+                for (size_t dB = 0; dB < pair_def->ndofB; dB++) {
+                    for (size_t i = 0; i < moltype_nmols[hA]; i++) {
+                        plan->pairs[pair].cross_spectrum = d;
+                        plan->pairs[pair].slotA = cross_spectrum_slot(
+                            map, moltype_natomspermol, hA, pair_def->dofA_type,
+                            pair_def->dofA_list[dA], i);
+                        plan->pairs[pair].slotB = cross_spectrum_slot(
+                            map, moltype_natomspermol, hB, pair_def->dofB_type,
+                            pair_def->dofB_list[dB], i);
+                        plan->pairs[pair].weight = weight;
+                        pair++;
+                    }
+                }
+            }
+            if (cross_spectra_def[d].type != 'e') {
+                continue;
+            }
+            cross_spectrum_factors *factors = &plan->factors[factor];
+            factors->cross_spectrum = d;
+            factors->nslotsA = pair_def->ndofA * moltype_nmols[hA];
+            factors->nslotsB = pair_def->ndofB * moltype_nmols[hB];
+            factors->slotsA = malloc(factors->nslotsA * sizeof(size_t));
+            factors->slotsB = malloc(factors->nslotsB * sizeof(size_t));
+            for (size_t dA = 0; dA < pair_def->ndofA; dA++) {
+                for (size_t i = 0; i < moltype_nmols[hA]; i++) {
+                    factors->slotsA[dA * moltype_nmols[hA] + i] =
+                        cross_spectrum_slot(map, moltype_natomspermol, hA,
+                                            pair_def->dofA_type,
+                                            pair_def->dofA_list[dA], i);
+                }
+            }
+            for (size_t dB = 0; dB < pair_def->ndofB; dB++) {
+                for (size_t i = 0; i < moltype_nmols[hB]; i++) {
+                    factors->slotsB[dB * moltype_nmols[hB] + i] =
+                        cross_spectrum_slot(map, moltype_natomspermol, hB,
+                                            pair_def->dofB_type,
+                                            pair_def->dofB_list[dB], i);
+                }
+            }
+            factor++;
+        }
+    }
+}
+
+void free_cross_spectra_plan(cross_spectra_plan *plan) {
+    for (size_t f = 0; f < plan->nfactors; f++) {
+        free(plan->factors[f].slotsA);
+        free(plan->factors[f].slotsB);
+    }
+    for (size_t n = 0; n < plan->nneighbours; n++) {
+        free(plan->neighbours[n].dof_slotsA);
+        free(plan->neighbours[n].dof_slotsB);
+    }
+    free(plan->factors);
+    free(plan->pairs);
+    free(plan->neighbours);
+    free(plan->neighbour_pairs);
+    free(plan->neighbour_mol_pairs);
+    free(plan->correlations);
+    free(plan->ncross_contribs);
+}
+
+// pairs of all "n" spectra from the molecule pairs within the cutoff
+// the pairs are fixed for a whole block, they are taken from the centers of
+// mass in one frame of the block (pos and box), the last one, because
+// blocks of several lengths and overlapping blocks are filled from the same
+// stream of frames
+void calc_cross_spectra_neighbours(
+    cross_spectra_plan *plan, real *pos, real *box, bool no_pbc,
+    size_t *moltype_firstmol, size_t *moltype_nmols,
+    size_t *moltype_natomspermol, size_t *mols_firstatom,
+    real **moltype_atommasses, real *mols_mass) {
+    real box_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    if (no_pbc == false) {
+        invert_box(box, box_inv);
+    }
+
+    plan->nneighbour_pairs = 0;
+    for (size_t n = 0; n < plan->nneighbours; n++) {
+        cross_spectrum_neighbours *neighbours = &plan->neighbours[n];
+        size_t hA = neighbours->moltypeA;
+        size_t hB = neighbours->moltypeB;
+        real *comsA = malloc(3 * moltype_nmols[hA] * sizeof(real));
+        real *comsB = malloc(3 * moltype_nmols[hB] * sizeof(real));
+        calc_mols_com(pos, box, box_inv, no_pbc, moltype_firstmol[hA],
+                      moltype_nmols[hA], mols_firstatom,
+                      moltype_natomspermol[hA], moltype_atommasses[hA],
+                      mols_mass, comsA);
+        calc_mols_com(pos, box, box_inv, no_pbc, moltype_firstmol[hB],
+                      moltype_nmols[hB], mols_firstatom,
+                      moltype_natomspermol[hB], moltype_atommasses[hB],
+                      mols_mass, comsB);
+        size_t nmol_pairs = calc_neighbour_pairs(
+            moltype_nmols[hA], comsA, moltype_nmols[hB], comsB, box, !no_pbc,
+            neighbours->cutoff, neighbours->exclude_self,
+            &plan->neighbour_mol_pairs, &plan->neighbour_mol_pairs_capacity);
+        free(comsA);
+        free(comsB);
+
+        // one pair per dof pair and molecule pair
+        size_t npairs = nmol_pairs * neighbours->ndofA * neighbours->ndofB;
+        if (plan->nneighbour_pairs + npairs > plan->neighbour_pairs_capacity) {
+            plan->neighbour_pairs_capacity = plan->nneighbour_pairs + npairs;
+            plan->neighbour_pairs =
+                realloc(plan->neighbour_pairs, plan->neighbour_pairs_capacity *
+                                                   sizeof(cross_spectrum_pair));
+        }
+        cross_spectrum_pair *pairs =
+            &plan->neighbour_pairs[plan->nneighbour_pairs];
+        for (size_t m = 0; m < nmol_pairs; m++) {
+            size_t iA = plan->neighbour_mol_pairs[2 * m + 0];
+            size_t iB = plan->neighbour_mol_pairs[2 * m + 1];
+            for (size_t dA = 0; dA < neighbours->ndofA; dA++) {
+                for (size_t dB = 0; dB < neighbours->ndofB; dB++) {
+                    pairs->cross_spectrum = neighbours->cross_spectrum;
+                    pairs->slotA = neighbours->dof_slotsA[dA] +
+                                   iA * neighbours->mol_nslotsA;
+                    pairs->slotB = neighbours->dof_slotsB[dB] +
+                                   iB * neighbours->mol_nslotsB;
+                    pairs->weight = 1.0;
+                    pairs++;
+                }
+            }
+        }
+        plan->nneighbour_pairs += npairs;
+    }
+}
+
+// factorised "e" cross spectrum for the frequencies k0 to k0 + nk
+// work needs 2 * nk reals, fourier_sums 2 * nk complex
+void accumulate_cross_spectrum_factors(cross_spectrum_factors *factors,
+                                       bool real_part,
+                                       FFT(complex) *dof_fourier,
+                                       size_t fourier_stride, size_t k0,
+                                       size_t nk, real *work,
+                                       FFT(complex) *fourier_sums,
+                                       real *spectrum) { // output
+    real *magnitude_sumA = &work[0];
+    real *magnitude_sumB = &work[nk];
+    FFT(complex) *fourier_sumA = &fourier_sums[0];
+    FFT(complex) *fourier_sumB = &fourier_sums[nk];
+    memset(work, 0, 2 * nk * sizeof(real));
+    memset(fourier_sums, 0, 2 * nk * sizeof(FFT(complex)));
+    for (size_t n = 0; n < factors->nslotsA; n++) {
+        FFT(complex) *fourier =
+            &dof_fourier[factors->slotsA[n] * fourier_stride + k0];
+        if (real_part) {
+            accumulate_fourier(nk, fourier, fourier_sumA);
+        } else {
+            accumulate_magnitude(nk, fourier, magnitude_sumA);
+        }
+    }
+    for (size_t n = 0; n < factors->nslotsB; n++) {
+        FFT(complex) *fourier =
+            &dof_fourier[factors->slotsB[n] * fourier_stride + k0];
+        if (real_part) {
+            accumulate_fourier(nk, fourier, fourier_sumB);
+        } else {
+            accumulate_magnitude(nk, fourier, magnitude_sumB);
+        }
+    }
+    if (real_part) {
+        accumulate_real_cross_spectrum(nk, fourier_sumA, fourier_sumB, 1.0,
+                                       spectrum);
+    } else {
+        for (size_t k = 0; k < nk; k++) {
+            spectrum[k] += magnitude_sumA[k] * magnitude_sumB[k];
+        }
+    }
+}
+
+#endif
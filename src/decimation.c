@@ -0,0 +1,126 @@
+#include "cpu-dispatch.c"
+#include "precision.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#ifndef DECIMATION_DEF
+#define DECIMATION_DEF
+
+// fewest frames per block left after decimation
+#define MIN_DECIMATED_STEPS 8
+
+// largest integer decimation that keeps max_frequency below 5/6 of the new
+// Nyquist frequency, leaving a transition band for the low-pass filter
+// no decimation without max_frequency
+unsigned long calc_decimation_factor(real framelength, real max_frequency) {
+    if (max_frequency <= 0.0) {
+        return 1;
+    }
+    unsigned long decimation =
+        (unsigned long)(1.0 / (2.4 * framelength * max_frequency));
+    return decimation > 0 ? decimation : 1;
+}
+
+// number of frequencies from 0 up to max_frequency, all without
+// max_frequency
+unsigned long calc_nfrequencies_retained(unsigned long nfftsteps,
+                                         unsigned long nfrequencies,
+                                         real fft_framelength,
+                                         real max_frequency) {
+    if (max_frequency <= 0.0) {
+        return nfrequencies;
+    }
+    unsigned long nretained =
+        (unsigned long)(max_frequency * fft_framelength * nfftsteps) + 1;
+    return nretained < nfrequencies ? nretained : nfrequencies;
+}
+
+// Blackman windowed sinc low-pass with the cutoff at the Nyquist frequency
+// after decimation, the transition band is 1/6 of the new sampling rate
+// returns the number of taps (odd), unit gain at zero frequency
+size_t calc_lowpass_filter(unsigned long decimation, real **taps) { // output
+    size_t half = (size_t)ceil(16.5 * decimation);
+    size_t ntaps = 2 * half + 1;
+    *taps = malloc(ntaps * sizeof(real));
+    real sum = 0.0;
+    for (size_t j = 0; j < ntaps; j++) {
+        real n = (real)j - (real)half;
+        real sinc = n == 0.0 ? 1.0 / decimation
+                             : sin(M_PI * n / decimation) / (M_PI * n);
+        real window = 0.42 - 0.5 * cos(2.0 * M_PI * j / (ntaps - 1)) +
+                      0.08 * cos(4.0 * M_PI * j / (ntaps - 1));
+        (*taps)[j] = sinc * window;
+        sum += (*taps)[j];
+    }
+    for (size_t j = 0; j < ntaps; j++) {
+        (*taps)[j] /= sum;
+    }
+    return ntaps;
+}
+
+// index into a series of length n, mirrored at both ends
+long mirror_index(long i, long n) {
+    if (n == 1) {
+        return 0;
+    }
+    while (i < 0 || i >= n) {
+        i = i < 0 ? -i : 2 * (n - 1) - i;
+    }
+    return i;
+}
+
+// filter one series and keep every decimation-th point
+// the series is mirrored at the block ends, which keeps the power of the
+// first and last frames
+CPU_DISPATCH
+void decimate_one_series(unsigned long nblocksteps, unsigned long decimation,
+                         unsigned long nfftsteps, size_t ntaps, real *taps,
+                         const real *series, real *decimated) { // output
+    long half = (long)ntaps / 2;
+    for (unsigned long m = 0; m < nfftsteps; m++) {
+        long center = (long)(m * decimation);
+        real sum = 0.0;
+        if (center - half >= 0 && center + half < (long)nblocksteps) {
+            for (size_t j = 0; j < ntaps; j++) {
+                sum += taps[j] * series[center - half + (long)j];
+            }
+        } else {
+            for (size_t j = 0; j < ntaps; j++) {
+                sum += taps[j] * series[mirror_index(center - half + (long)j,
+                                                     (long)nblocksteps)];
+            }
+        }
+        decimated[m] = sum;
+    }
+}
+
+// low-pass and downsample nseries series of nblocksteps points to nfftsteps
+// points each in decimated
+void decimate_series(size_t nseries, unsigned long nblocksteps,
+                     unsigned long decimation, unsigned long nfftsteps,
+                     size_t ntaps, real *taps, const real *series,
+                     real *decimated) { // output
+#pragma omp parallel for schedule(static)
+    for (size_t s = 0; s < nseries; s++) {
+        decimate_one_series(nblocksteps, decimation, nfftsteps, ntaps, taps,
+                            &series[s * nblocksteps],
+                            &decimated[s * nfftsteps]);
+    }
+}
+
+// keep the first nretained of nfrequencies values of every spectrum, the
+// spectra are packed afterwards
+void truncate_spectra(size_t nspectra, unsigned long nfrequencies,
+                      unsigned long nretained, real *spectra) {
+    if (nretained == nfrequencies) {
+        return;
+    }
+    for (size_t s = 0; s < nspectra; s++) {
+        memmove(&spectra[s * nretained], &spectra[s * nfrequencies],
+                nretained * sizeof(real));
+    }
+}
+
+#endif
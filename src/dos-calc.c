@@ -1,19 +1,35 @@
+#include "block-length.c"
+#include "block-resolution.c"
+#include "block-store.c"
+#include "correlation.c"
+#include "cpu-dispatch.c"
+#include "cross-spectra.c"
+#include "decimation.c"
+#include "fft-backend.h"
 #include "fft.c"
+#include "load-balancing.c"
+#include "neighbour-list.c"
 #include "parse-dosparams.c"
+#include "precision.h"
 #include "structs.h"
+#include "subsampling.c"
 #include "trajectory-functions.c"
 #include "velocity-decomposition.c"
 #include "verbPrintf.c"
+#include "window.c"
 #include "write-dos.c"
+#include "write-npz.c"
 #include <argp.h>
 #include <cblas.h>
 #include <chemfiles.h>
-#include <math.h>
+#include <limits.h>
 #include <omp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
 
 // CLI stuff
 const char *argp_program_version = VERSION;
@@ -26,7 +42,12 @@ static struct argp_option options[] = {
     {"verbose", 'v', 0, 0, "Produce verbose output", 0},
     {"no-pbc", 'p', 0, 0,
      "Do not recombine molecules seperated by periodic boundary conditions", 0},
-    {"outfile", 'o', "FILE", 0, "Output json file. Default: dos.json", 0},
+    {"outfile", 'o', "FILE", 0,
+     "Output file. Default: dos.json or dos.npz", 0},
+    {"format", 'F', "FORMAT", 0,
+     "Output format: json or npz (uncompressed numpy arrays in the working "
+     "precision with json metadata, can be memory-mapped). Default: json",
+     0},
     {"framelength", 'f', "FL", 0,
      "Lenght of each frame in trajectory (in ps). Taken from trajectory if "
      "possible, but can be overwritten with this argument.",
@@ -35,6 +56,34 @@ static struct argp_option options[] = {
      "Number of frames to be skipped at the beginning of the trajectory.", 0},
     {"refconf", 'e', "FILE", 0,
      "When using Eckart frame, take reference configuration from this file", 0},
+    {"fftw-wisdom", 'w', "FILE", 0,
+     "Import FFTW wisdom from this file (if it exists) and export it in the "
+     "end. Wisdom is specific to the precision and the machine.",
+     0},
+    {"planner-effort", 'l', "EFFORT", 0,
+     "FFTW planner effort: ESTIMATE, MEASURE or PATIENT. Default: MEASURE", 0},
+    {"correlations", 'c', "MODE", 0,
+     "Also write correlation functions (inverse FFT of the spectra): none, "
+     "circular or linear (series zero padded to twice the block length). "
+     "Default: none",
+     0},
+    {"zero-pad", 'z', 0, 0,
+     "Zero pad the series to the next FFT-friendly length (2^a 3^b 5^c 7^d) "
+     "if the block length has larger prime factors.",
+     0},
+    {"fft-packing", 'k', "MODE", 0,
+     "Transform two real series with one complex FFT, pairing: none, xy "
+     "(consecutive components), atoms or molecules. Default: none",
+     0},
+    {"block-store", 'B', "FILE", 0,
+     "Also write the raw spectra, moi and Coriolis sums of every block to "
+     "FILE (npz), to regroup them later with scripts/regroup-blocks.py",
+     0},
+    {"tolerance", 't', "TOL", 0,
+     "End a sample before nblocks blocks once another block changes the "
+     "integrated spectra by less than TOL (relative). Default: 0 (always "
+     "nblocks blocks)",
+     0},
     {0}};
 
 struct arguments {
@@ -42,9 +91,17 @@ struct arguments {
     bool verbosity;
     bool no_pbc;
     char *outfile;
-    float framelength;
+    char format;
+    real framelength;
     unsigned long long skip_frames;
     char *refconf;
+    char *fftw_wisdom;
+    unsigned planner_effort;
+    char fft_packing;
+    bool zero_pad;
+    char correlations;
+    real tolerance;
+    char *block_store;
 };
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -62,6 +119,14 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     case 'o':
         arguments->outfile = arg;
         break;
+    case 'F':
+        if (strcmp(arg, "json") == 0)
+            arguments->format = 'j';
+        else if (strcmp(arg, "npz") == 0)
+            arguments->format = 'n';
+        else
+            argp_error(state, "unknown output format '%s'", arg);
+        break;
     case 'f':
         arguments->framelength = strtof(arg, NULL);
         break;
@@ -71,6 +136,47 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     case 'e':
         arguments->refconf = arg;
         break;
+    case 'w':
+        arguments->fftw_wisdom = arg;
+        break;
+    case 'l':
+        if (!parse_planner_effort(arg, &arguments->planner_effort)) {
+            argp_error(state, "unknown planner effort '%s'", arg);
+        }
+        break;
+    case 'c':
+        if (strcmp(arg, "none") == 0)
+            arguments->correlations = 'n';
+        else if (strcmp(arg, "circular") == 0)
+            arguments->correlations = 'c';
+        else if (strcmp(arg, "linear") == 0)
+            arguments->correlations = 'l';
+        else
+            argp_error(state, "unknown correlations mode '%s'", arg);
+        break;
+    case 'z':
+        arguments->zero_pad = true;
+        break;
+    case 'k':
+        if (strcmp(arg, "none") == 0)
+            arguments->fft_packing = 'n';
+        else if (strcmp(arg, "xy") == 0)
+            arguments->fft_packing = 'x';
+        else if (strcmp(arg, "atoms") == 0)
+            arguments->fft_packing = 'a';
+        else if (strcmp(arg, "molecules") == 0)
+            arguments->fft_packing = 'm';
+        else
+            argp_error(state, "unknown FFT packing '%s'", arg);
+        break;
+    case 'B':
+        arguments->block_store = arg;
+        break;
+    case 't':
+        arguments->tolerance = strtof(arg, NULL);
+        if (arguments->tolerance < 0.0)
+            argp_error(state, "tolerance has to be at least 0");
+        break;
 
     case ARGP_KEY_ARG:
         /* Too many arguments. */
@@ -106,13 +212,24 @@ int main(int argc, char *argv[]) {
     // Default values.
     arguments.verbosity = false;
     arguments.no_pbc = false;
-    arguments.outfile = "dos.json";
+    arguments.outfile = NULL;
+    arguments.format = 'j';
     arguments.framelength = 0.0;
     arguments.skip_frames = 0;
     arguments.refconf = NULL;
+    arguments.fftw_wisdom = NULL;
+    arguments.planner_effort = FFT_MEASURE;
+    arguments.fft_packing = 'n';
+    arguments.zero_pad = false;
+    arguments.correlations = 'n';
+    arguments.tolerance = 0.0;
+    arguments.block_store = NULL;
 
     // parse command line arguments
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
+    if (arguments.outfile == NULL) {
+        arguments.outfile = arguments.format == 'n' ? "dos.npz" : "dos.json";
+    }
 
     // define convenience aliases
     bool verbosity = arguments.verbosity;
@@ -121,18 +238,28 @@ int main(int argc, char *argv[]) {
     char *refconf_file = arguments.refconf;
     verbPrintf(arguments.verbosity, "dosparams file: %s\n", dosparams_file);
     verbPrintf(arguments.verbosity, "trajectory file: %s\n", trajectory_file);
+    verbPrintf(arguments.verbosity, "vectorised kernels: %s\n",
+               cpu_dispatch_level());
+    verbPrintf(arguments.verbosity, "working precision: %s\n",
+               PRECISION_NAME);
     if (refconf_file) {
         verbPrintf(arguments.verbosity, "refconf file: %s\n", refconf_file);
     }
 
     // input that will be scanned
-    size_t nsamples;
-    size_t nblocks;
-    unsigned long nblocksteps;
+    size_t nresolutions;
+    size_t *nsamples;
+    size_t *nblocks;
+    unsigned long *nblocksteps;
+    real max_frequency;
+    real block_overlap;
+    char window;
+    unsigned long subsample_seed;
     size_t nmoltypes;
     size_t *moltypes_nmols;
+    size_t *moltypes_nselected;
     size_t *moltypes_natomspermol;
-    float **moltypes_atommasses;
+    real **moltypes_atommasses;
     char *moltypes_rot_treat;
     int **moltypes_abc_indicators;
     size_t ncross_spectra;
@@ -142,15 +269,20 @@ int main(int argc, char *argv[]) {
     // NOTE: this calls alloc() functions, use free_dosparams_arrays() in the
     // end
     parse_dosparams(dosparams_file,
-                    &nsamples, // output
-                    &nblocks, &nblocksteps, &nmoltypes, &moltypes_nmols,
+                    &nresolutions, // output
+                    &nsamples, &nblocks, &nblocksteps, &max_frequency,
+                    &block_overlap, &window, &subsample_seed, &nmoltypes,
+                    &moltypes_nmols, &moltypes_nselected,
                     &moltypes_natomspermol, &moltypes_atommasses,
                     &moltypes_rot_treat, &moltypes_abc_indicators,
                     &ncross_spectra, &cross_spectra_def);
 
     if (arguments.verbosity) {
-        print_dosparams(nsamples, nblocks, nblocksteps, nmoltypes,
-                        moltypes_nmols, moltypes_natomspermol,
+        print_dosparams(nresolutions, nsamples, nblocks, nblocksteps,
+                        max_frequency,
+                        block_overlap, window, subsample_seed, nmoltypes,
+                        moltypes_nmols, moltypes_nselected,
+                        moltypes_natomspermol,
                         moltypes_atommasses, moltypes_rot_treat,
                         moltypes_abc_indicators);
     }
@@ -158,12 +290,11 @@ int main(int argc, char *argv[]) {
     // generate convenience variables and arrays
     size_t natoms = 0;
     size_t nmols = 0;
-    unsigned long nfrequencies = nblocksteps / 2 + 1;
     size_t *moltypes_firstmol = calloc(nmoltypes, sizeof(size_t));
     size_t *moltypes_firstatom = calloc(nmoltypes, sizeof(size_t));
     size_t *mols_moltypenr;
     size_t *mols_natoms;
-    float *mols_mass;
+    real *mols_mass;
     size_t *mols_firstatom;
     calc_convenience_variables(
         nmoltypes, moltypes_nmols, moltypes_natomspermol, moltypes_atommasses,
@@ -171,6 +302,62 @@ int main(int argc, char *argv[]) {
         &nmols, moltypes_firstmol, moltypes_firstatom, &mols_moltypenr,
         &mols_natoms, &mols_mass, &mols_firstatom);
 
+    // molecule schedules for load balancing (descending cost)
+    float *moltypes_decomposition_cost = calloc(nmoltypes, sizeof(float));
+    float *moltypes_fft_cost = calloc(nmoltypes, sizeof(float));
+    for (size_t h = 0; h < nmoltypes; h++) {
+        moltypes_decomposition_cost[h] = moltype_decomposition_cost(
+            moltypes_natomspermol[h], moltypes_rot_treat[h]);
+        moltypes_fft_cost[h] = moltype_fft_cost(moltypes_natomspermol[h],
+                                                moltypes_rot_treat[h]);
+    }
+    size_t *mols_order_decomposition = calloc(nmols, sizeof(size_t));
+    size_t *mols_order_fft = calloc(nmols, sizeof(size_t));
+    bool mols_schedule_dynamic =
+        calc_mols_schedule(nmols, mols_moltypenr, moltypes_decomposition_cost,
+                           mols_order_decomposition);
+    calc_mols_schedule(nmols, mols_moltypenr, moltypes_fft_cost,
+                       mols_order_fft);
+
+    // random subsets of the molecules (sample_fraction, max_mols), the
+    // others are neither decomposed nor transformed and their series stay
+    // zero
+    bool *mols_selected = calloc(nmols, sizeof(bool));
+    bool subsampled =
+        select_mols(nmoltypes, moltypes_firstmol, moltypes_nmols,
+                    moltypes_nselected, subsample_seed, mols_selected);
+    size_t nmols_selected =
+        filter_mols_order(nmols, mols_selected, mols_order_decomposition);
+    filter_mols_order(nmols, mols_selected, mols_order_fft);
+    for (size_t h = 0; h < nmoltypes; h++) {
+        if (moltypes_nselected[h] < moltypes_nmols[h]) {
+            verbPrintf(verbosity,
+                       "moltype %zu: %zu of %zu molecules (seed %lu)\n", h,
+                       moltypes_nselected[h], moltypes_nmols[h],
+                       subsample_seed);
+        }
+    }
+
+    fft_work_item *fft_work_items;
+    size_t nfft_work_items = calc_fft_work_items(
+        nmols_selected, mols_order_fft, mols_moltypenr, moltypes_firstmol,
+        moltypes_natomspermol, arguments.fft_packing == 'm',
+        omp_get_max_threads(), &fft_work_items);
+    verbPrintf(verbosity, "decomposition schedule: %s\n",
+               mols_schedule_dynamic ? "dynamic" : "static");
+    verbPrintf(verbosity, "FFT work items: %zu for %zu molecules\n",
+               nfft_work_items, nmols);
+    if (arguments.fft_packing != 'n') {
+        verbPrintf(verbosity, "FFT packing: %c\n", arguments.fft_packing);
+    }
+
+    // transforms that have to be kept for the cross spectra
+    dof_fourier_map fourier_map;
+    calc_dof_fourier_map(nmoltypes, moltypes_nmols, moltypes_natomspermol,
+                         ncross_spectra, cross_spectra_def, &fourier_map);
+    verbPrintf(verbosity, "stored transforms for cross spectra: %zu\n",
+               fourier_map.nslots);
+
     // open trajectory and one frame for tests
     verbPrintf(verbosity, "testing file %s\n", trajectory_file);
     CHFL_TRAJECTORY *file = chfl_trajectory_open(trajectory_file, 'r');
@@ -184,10 +371,10 @@ int main(int argc, char *argv[]) {
     check_frame_natoms(frame, natoms);
     // check for velocities
     check_frame_velocities(frame);
-    // check for orthorombic box
-    check_frame_orthorombic_box(frame, arguments.no_pbc);
+    // check for periodic box
+    check_frame_periodic_box(frame, arguments.no_pbc);
     // get framelength
-    float framelength;
+    real framelength;
     if (arguments.framelength == 0.0) {
         framelength = get_traj_framelength(file, frame);
     } else {
@@ -196,6 +383,20 @@ int main(int argc, char *argv[]) {
     chfl_trajectory_close(file);
     verbPrintf(verbosity, "framelength is %f ps\n", framelength);
 
+    // series are low-pass filtered and decimated before the FFT if
+    // max_frequency is given, only frequencies up to max_frequency are
+    // written
+    unsigned long decimation =
+        calc_decimation_factor(framelength, max_frequency);
+    real fft_framelength = decimation * framelength;
+    real *lowpass_taps = NULL;
+    size_t nlowpass_taps = 0;
+    if (decimation > 1) {
+        nlowpass_taps = calc_lowpass_filter(decimation, &lowpass_taps);
+        verbPrintf(verbosity, "decimation by %lu (%zu filter taps)\n",
+                   decimation, nlowpass_taps);
+    }
+
     // test if refconf file is needed but not given and vice versa
     bool refconf_needed = false;
     for (size_t h = 0; h < nmoltypes; h++) {
@@ -216,9 +417,9 @@ int main(int argc, char *argv[]) {
     }
 
     // open, test, and evaluate refconf file
-    float *refconf_pos = calloc(natoms * 3, sizeof(float));
-    float *refconf_box = calloc(3, sizeof(float));
-    float *atom_refpos_principal_components = calloc(natoms * 3, sizeof(float));
+    real *refconf_pos = calloc(natoms * 3, sizeof(real));
+    real *refconf_box = calloc(9, sizeof(real));
+    real *atom_refpos_principal_components = calloc(natoms * 3, sizeof(real));
     if (refconf_file) {
         verbPrintf(verbosity, "start reading refconf\n");
         file = chfl_trajectory_open(refconf_file, 'r');
@@ -229,8 +430,8 @@ int main(int argc, char *argv[]) {
         }
         // check for number of atoms
         check_frame_natoms(frame, natoms);
-        // check for orthorombic box
-        check_frame_orthorombic_box(frame, arguments.no_pbc);
+        // check for periodic box
+        check_frame_periodic_box(frame, arguments.no_pbc);
         get_frame_pos_box(frame, natoms, refconf_pos, refconf_box);
         chfl_trajectory_close(file);
         // get principal axis if rot_type == 'e'
@@ -255,236 +456,608 @@ int main(int argc, char *argv[]) {
                                  "rot_y",  "rot_z",  "vib_x",  "vib_y",
                                  "vib_z",  "roto_a", "roto_b", "roto_c",
                                  "vibc_x", "vibc_y", "vibc_z"};
-    // order is: trn_xyz, rot_xyz, vib_xyz, rot_omega_abc
-    // this one has all the dos in it
-    float *moltypes_dos_samples =
-        calloc(nmoltypes * ndos * nsamples * nfrequencies, sizeof(float));
-    // this one all cross spectra
-    float *cross_spectra_samples =
-        calloc(ncross_spectra * nsamples * nfrequencies, sizeof(float));
-    // moments of inertia and its std. deviation
-    float *moltypes_samples_moments_of_inertia =
-        calloc(nmoltypes * nsamples * 3, sizeof(float));
-    float *moltypes_samples_moments_of_inertia_squared =
-        calloc(nmoltypes * nsamples * 3, sizeof(float));
-    float *moltypes_samples_moments_of_inertia_std =
-        calloc(nmoltypes * nsamples * 3, sizeof(float));
-    // coriolis energy term
-    float *moltypes_samples_coriolis =
-        calloc(nmoltypes * nsamples, sizeof(float));
+
+    // one set of spectra for every block length
+    // decomposed series per frame: trn, omega, vib, rot, vibc, moi, moi
+    // squared, coriolis (see NBLOCK_SERIES)
+    size_t nseries[NBLOCK_SERIES] = {3 * nmols,  3 * nmols,  3 * natoms,
+                                     3 * natoms, 3 * natoms, 3 * nmols,
+                                     3 * nmols,  nmols};
+    block_resolution *resolutions =
+        malloc(nresolutions * sizeof(block_resolution));
+    for (size_t r = 0; r < nresolutions; r++) {
+        block_resolution *res = &resolutions[r];
+        init_block_resolution(nsamples[r], nblocks[r], nblocksteps[r],
+                              block_overlap, window, decimation,
+                              fft_framelength, max_frequency,
+                              arguments.zero_pad, arguments.correlations == 'l',
+                              nmols, nmoltypes * ndos, nseries, verbosity,
+                              res);
+
+        // cross spectra as flat lists of slots of the stored transforms
+        compile_cross_spectra(moltypes_nmols, moltypes_natomspermol,
+                              ncross_spectra, cross_spectra_def, &fourier_map,
+                              &res->cross_plan);
+        verbPrintf(verbosity,
+                   "cross spectrum pairs: %zu, factorised sums: %zu\n",
+                   res->cross_plan.npairs, res->cross_plan.nfactors);
+
+        // order is: trn_xyz, rot_xyz, vib_xyz, rot_omega_abc
+        // this one has all the dos in it
+        res->moltypes_dos_samples =
+            calloc(nmoltypes * ndos * res->nsamples * res->nfrequencies,
+                   sizeof(real));
+        // squared deviations of the block spectra for the standard error
+        if (subsampled && res->nblocks > 1) {
+            res->moltypes_dos_m2_samples =
+                calloc(nmoltypes * ndos * res->nsamples * res->nfrequencies,
+                       sizeof(real));
+        }
+        // this one all cross spectra
+        res->cross_spectra_samples = calloc(
+            ncross_spectra * res->nsamples * res->nfrequencies, sizeof(real));
+        // moments of inertia and its std. deviation
+        res->moltypes_samples_moments_of_inertia =
+            calloc(nmoltypes * res->nsamples * 3, sizeof(real));
+        res->moltypes_samples_moments_of_inertia_squared =
+            calloc(nmoltypes * res->nsamples * 3, sizeof(real));
+        res->moltypes_samples_moments_of_inertia_std =
+            calloc(nmoltypes * res->nsamples * 3, sizeof(real));
+        // coriolis energy term
+        res->moltypes_samples_coriolis =
+            calloc(nmoltypes * res->nsamples, sizeof(real));
+    }
+
+    // every block on its own (optional)
+    block_store *stores = NULL;
+    if (arguments.block_store) {
+        stores = malloc(nresolutions * sizeof(block_store));
+        for (size_t r = 0; r < nresolutions; r++) {
+            init_block_store(nmoltypes, ndos, ncross_spectra,
+                             resolutions[r].nfrequencies_retained,
+                             &stores[r]);
+        }
+    }
+
+    // FFT plans, created in the first block and reused for all others
+    verbPrintf(verbosity, "FFT backend: %s\n", FFT_BACKEND_NAME);
+    fft_plan_cache plan_cache;
+    init_fft_plan_cache(&plan_cache, arguments.planner_effort);
+    if (arguments.fftw_wisdom) {
+        if (FFT(import_wisdom_from_filename)(arguments.fftw_wisdom)) {
+            verbPrintf(verbosity, "imported FFTW wisdom from %s\n",
+                       arguments.fftw_wisdom);
+        } else {
+            verbPrintf(verbosity, "no FFTW wisdom imported from %s\n",
+                       arguments.fftw_wisdom);
+        }
+    }
 
     // TIMING: parse end
     timings[0] += omp_get_wtime() - begin;
     begin = omp_get_wtime();
 
-    // start samples loop
-    verbPrintf(verbosity, "going through %zu samples\n", nsamples);
-    for (size_t sample = 0; sample < nsamples; sample++) {
-        verbPrintf(verbosity, "now doing sample %zu\n", sample);
-
-        // moi/coiolis of mols (this sample)
-        float *mol_moments_of_inertia = calloc(nmols * 3, sizeof(float));
-        float *mol_moments_of_inertia_squared =
-            calloc(nmols * 3, sizeof(float));
-        float *mol_coriolis = calloc(nmols, sizeof(float));
-
-        // start block loop
-        verbPrintf(verbosity, "going through %zu blocks\n", nblocks);
-        for (size_t block = 0; block < nblocks; block++) {
-            verbPrintf(verbosity, "now doing block %zu\n", block);
-
-            verbPrintf(verbosity, "start reading trajectory block\n");
-            float *block_pos = calloc(natoms * 3 * nblocksteps, sizeof(float));
-            float *block_vel = calloc(natoms * 3 * nblocksteps, sizeof(float));
-            float *block_box = calloc(3 * nblocksteps, sizeof(float));
-            get_traj_pos_vel_box(file, nblocksteps, natoms, block_pos,
-                                 block_vel, block_box);
-
-            // TIMING: read_trj end
-            timings[1] += omp_get_wtime() - begin;
-            begin = omp_get_wtime();
-
-            verbPrintf(verbosity, "start decomposition\n");
-            // series to be fourier transformed per block
-            float *mol_velocities_sqrt_m_trn =
-                calloc(nmols * 3 * nblocksteps, sizeof(float));
-            float *mol_omegas_sqrt_i_rot =
-                calloc(nmols * 3 * nblocksteps, sizeof(float));
-            float *atom_velocities_sqrt_m_vib =
-                calloc(natoms * 3 * nblocksteps, sizeof(float));
-            float *atom_velocities_sqrt_m_rot =
-                calloc(natoms * 3 * nblocksteps, sizeof(float));
-            float *atom_velocities_sqrt_m_vibc =
-                calloc(natoms * 3 * nblocksteps, sizeof(float));
-            // per block vectors
-            float *mol_block_moments_of_inertia =
-                calloc(nmols * 3 * nblocksteps, sizeof(float));
-            float *mol_block_moments_of_inertia_squared =
-                calloc(nmols * 3 * nblocksteps, sizeof(float));
-            // per block numbers
-            float *mol_block_coriolis =
-                calloc(nmols * nblocksteps, sizeof(float));
-            decompose_velocities(
-                block_pos, block_vel, block_box, nblocksteps, natoms, nmols,
-                mols_firstatom, mols_natoms, mols_moltypenr,
-                moltypes_atommasses, mols_mass, moltypes_rot_treat,
-                moltypes_abc_indicators, arguments.no_pbc,
-                atom_refpos_principal_components,
-                mol_velocities_sqrt_m_trn, // output
-                mol_omegas_sqrt_i_rot, atom_velocities_sqrt_m_vib,
-                atom_velocities_sqrt_m_rot, atom_velocities_sqrt_m_vibc,
-                mol_block_moments_of_inertia,
-                mol_block_moments_of_inertia_squared, mol_block_coriolis);
-
-            // TIMING: vel_decomp end
-            timings[2] += omp_get_wtime() - begin;
-            begin = omp_get_wtime();
-
-            verbPrintf(verbosity, "start DoS calculation (FFT)\n");
-            dos_calculation(
-                nmoltypes, nblocksteps, nfrequencies, moltypes_firstmol,
-                moltypes_firstatom, moltypes_nmols, moltypes_natomspermol,
-                mol_velocities_sqrt_m_trn, mol_omegas_sqrt_i_rot,
-                atom_velocities_sqrt_m_vib, atom_velocities_sqrt_m_rot,
-                atom_velocities_sqrt_m_vibc, ndos, nsamples, sample,
-                ncross_spectra, cross_spectra_def,
-                moltypes_dos_samples, // output
-                cross_spectra_samples);
-
-            // moi summation over all nblocksteps (this block)
-            for (size_t i = 0; i < nmols; i++) {
-                for (size_t t = 0; t < nblocksteps; t++) {
-                    for (size_t abc = 0; abc < 3; abc++) {
-                        mol_moments_of_inertia[3 * i + abc] +=
-                            mol_block_moments_of_inertia[3 * nblocksteps * i +
-                                                         nblocksteps * abc + t];
-                        mol_moments_of_inertia_squared[3 * i + abc] +=
-                            mol_block_moments_of_inertia_squared
-                                [3 * nblocksteps * i + nblocksteps * abc + t];
+    // all block lengths are filled from one pass over the trajectory, it is
+    // read and decomposed in chunks of the smallest number of new frames per
+    // block, so every frame is read and decomposed once
+    unsigned long nframes = 0;
+    unsigned long nchunksteps = ULONG_MAX;
+    for (size_t r = 0; r < nresolutions; r++) {
+        unsigned long res_nframes = block_resolution_nframes(&resolutions[r]);
+        nframes = res_nframes > nframes ? res_nframes : nframes;
+        nchunksteps = resolutions[r].nhopsteps < nchunksteps
+                          ? resolutions[r].nhopsteps
+                          : nchunksteps;
+    }
+    real *block_pos = calloc(natoms * 3 * nchunksteps, sizeof(real));
+    real *block_vel = calloc(natoms * 3 * nchunksteps, sizeof(real));
+    real *block_box = calloc(9 * nchunksteps, sizeof(real));
+    real *chunk_series[NBLOCK_SERIES];
+    for (size_t s = 0; s < NBLOCK_SERIES; s++) {
+        chunk_series[s] = calloc(nseries[s] * nchunksteps, sizeof(real));
+    }
+
+    // start chunks loop
+    verbPrintf(verbosity, "going through %lu frames in chunks of %lu\n",
+               nframes, nchunksteps);
+    unsigned long frame0 = 0;
+    for (; frame0 < nframes; frame0 += nchunksteps) {
+        // with --tolerance samples can end early, stop reading once all
+        // are done
+        bool done = true;
+        for (size_t r = 0; r < nresolutions; r++) {
+            done = done && block_resolution_done(&resolutions[r]);
+        }
+        if (done) {
+            break;
+        }
+        unsigned long nsteps = nframes - frame0 < nchunksteps
+                                   ? nframes - frame0
+                                   : nchunksteps;
+
+        verbPrintf(verbosity, "start reading trajectory chunk\n");
+        get_traj_pos_vel_box(file, nsteps, natoms, block_pos, block_vel,
+                             block_box);
+
+        // TIMING: read_trj end
+        timings[1] += omp_get_wtime() - begin;
+        begin = omp_get_wtime();
+
+        verbPrintf(verbosity, "start decomposition\n");
+        for (size_t s = 0; s < NBLOCK_SERIES; s++) {
+            memset(chunk_series[s], 0, nseries[s] * nsteps * sizeof(real));
+        }
+        decompose_velocities(
+            block_pos, block_vel, block_box, nsteps, natoms, nmols_selected,
+            mols_firstatom, mols_natoms, mols_moltypenr, moltypes_atommasses,
+            mols_mass, moltypes_rot_treat, moltypes_abc_indicators,
+            arguments.no_pbc, atom_refpos_principal_components,
+            mols_order_decomposition, mols_schedule_dynamic,
+            chunk_series[0], // output
+            chunk_series[1], chunk_series[2], chunk_series[3],
+            chunk_series[4], chunk_series[5], chunk_series[6],
+            chunk_series[7]);
+
+        // TIMING: vel_decomp end
+        timings[2] += omp_get_wtime() - begin;
+        begin = omp_get_wtime();
+
+        for (size_t r = 0; r < nresolutions; r++) {
+            block_resolution *res = &resolutions[r];
+            unsigned long first = 0;
+            while (first < nsteps && !block_resolution_done(res)) {
+                first += append_block_frames(res, nseries, nsteps,
+                                             chunk_series, first);
+                if (res->nfilled < res->nblocksteps) {
+                    continue;
+                }
+                verbPrintf(verbosity,
+                           "now doing block %zu of sample %zu (block length "
+                           "%lu)\n",
+                           res->block, res->sample, res->nblocksteps);
+
+                // molecule pairs of "n" cross spectra from the last frame of
+                // the block
+                if (res->cross_plan.nneighbours > 0) {
+                    calc_cross_spectra_neighbours(
+                        &res->cross_plan, &block_pos[3 * natoms * (first - 1)],
+                        &block_box[9 * (first - 1)], arguments.no_pbc,
+                        moltypes_firstmol, moltypes_nmols,
+                        moltypes_natomspermol, mols_firstatom,
+                        moltypes_atommasses, mols_mass);
+                    verbPrintf(verbosity,
+                               "neighbour cross spectrum pairs: %zu\n",
+                               res->cross_plan.nneighbour_pairs);
+                }
+
+                // series to be fourier transformed, the block buffers keep
+                // the frames shared with the next block and are transformed
+                // directly unless they need to be decimated, windowed or
+                // padded first
+                real *fft_series[5];
+                for (size_t s = 0; s < 5; s++) {
+                    if (res->fft_series[s] == NULL) {
+                        fft_series[s] = res->block_series[s];
+                        continue;
+                    }
+                    fft_series[s] = res->fft_series[s];
+                    // anti-aliased decimation of the series below
+                    // max_frequency
+                    if (decimation > 1) {
+                        decimate_series(nseries[s], res->nblocksteps,
+                                        decimation, res->nfftsteps,
+                                        nlowpass_taps, lowpass_taps,
+                                        res->block_series[s], fft_series[s]);
+                    } else {
+                        memcpy(fft_series[s], res->block_series[s],
+                               nseries[s] * res->nblocksteps * sizeof(real));
+                    }
+                    if (window != 'r') {
+                        apply_window(nseries[s], res->nfftsteps,
+                                     res->window_weights, fft_series[s]);
+                    }
+                    if (res->nfftpoints > res->nfftsteps) {
+                        pad_series(nseries[s], res->nfftsteps,
+                                   res->nfftpoints, fft_series[s]);
                     }
                 }
-            }
 
-            // coriolis summation over all nblocksteps (this block)
-            for (size_t i = 0; i < nmols; i++) {
-                for (size_t t = 0; t < nblocksteps; t++) {
-                    mol_coriolis[i] += mol_block_coriolis[nblocksteps * i + t];
+                // spectra and moi/coriolis sums of the block alone
+                real *moltypes_dos_block = NULL;
+                real *cross_spectra_block = NULL;
+                real *moltypes_block_moments[3] = {NULL, NULL, NULL};
+                if (stores) {
+                    moltypes_dos_block = calloc(
+                        nmoltypes * ndos * res->nfrequencies, sizeof(real));
+                    cross_spectra_block = calloc(
+                        ncross_spectra * res->nfrequencies, sizeof(real));
+                    moltypes_block_moments[0] =
+                        calloc(nmoltypes * 3, sizeof(real));
+                    moltypes_block_moments[1] =
+                        calloc(nmoltypes * 3, sizeof(real));
+                    moltypes_block_moments[2] = calloc(nmoltypes, sizeof(real));
                 }
-            }
 
-            // TIMING: fft end
-            timings[3] += omp_get_wtime() - begin;
-            begin = omp_get_wtime();
-
-            // free block stuff
-            free(block_pos);
-            free(block_vel);
-            free(block_box);
-            free(mol_velocities_sqrt_m_trn);
-            free(mol_omegas_sqrt_i_rot);
-            free(atom_velocities_sqrt_m_vib);
-            free(atom_velocities_sqrt_m_rot);
-            free(atom_velocities_sqrt_m_vibc);
-            free(mol_block_moments_of_inertia);
-            free(mol_block_moments_of_inertia_squared);
-            free(mol_block_coriolis);
-        }
-        verbPrintf(verbosity, "finished all blocks\n");
-
-        // divide moi by number of blocks and number of blocksteps
-        cblas_sscal(nmols * 3, 1.0 / (float)nblocks / (float)nblocksteps,
-                    mol_moments_of_inertia, 1);
-        cblas_sscal(nmols * 3, 1.0 / (float)nblocks / (float)nblocksteps,
-                    mol_moments_of_inertia_squared, 1);
-        // divide coriolis by number of blocks and number of blocksteps
-        cblas_sscal(nmols, 1.0 / (float)nblocks / (float)nblocksteps,
-                    mol_coriolis, 1);
-
-        // moi summation over all molecules (this sample)
-        for (size_t i = 0; i < nmols; i++) {
-            for (size_t abc = 0; abc < 3; abc++) {
-                size_t moi_index =
-                    mols_moltypenr[i] * nsamples * 3 + sample * 3 + abc;
-                moltypes_samples_moments_of_inertia[moi_index] +=
-                    mol_moments_of_inertia[3 * i + abc];
-                moltypes_samples_moments_of_inertia_squared[moi_index] +=
-                    mol_moments_of_inertia_squared[3 * i + abc];
+                verbPrintf(verbosity, "start DoS calculation (FFT)\n");
+                dos_calculation(
+                    nmoltypes, res->nfftpoints, res->nfrequencies,
+                    moltypes_firstmol, moltypes_firstatom,
+                    moltypes_natomspermol, moltypes_rot_treat,
+                    mols_moltypenr, nfft_work_items, fft_work_items,
+                    &plan_cache, arguments.fft_packing, &fourier_map,
+                    fft_series[0], fft_series[1], fft_series[2],
+                    fft_series[3], fft_series[4], ndos, res->nsamples,
+                    res->sample, res->block, &res->cross_plan,
+                    res->moltypes_dos_samples, // output
+                    res->moltypes_dos_m2_samples,
+                    res->cross_spectra_samples, moltypes_dos_block,
+                    cross_spectra_block);
+
+                // moi and coriolis summation over all nblocksteps (this
+                // block), also per moltype for the block store
+                unsigned long n = res->nblocksteps;
+                for (size_t i = 0; i < nmols; i++) {
+                    real block_moments[7] = {0.0};
+                    for (size_t t = 0; t < n; t++) {
+                        for (size_t abc = 0; abc < 3; abc++) {
+                            block_moments[abc] +=
+                                res->block_series[5][3 * n * i + n * abc + t];
+                            block_moments[3 + abc] +=
+                                res->block_series[6][3 * n * i + n * abc + t];
+                        }
+                        block_moments[6] += res->block_series[7][n * i + t];
+                    }
+                    for (size_t abc = 0; abc < 3; abc++) {
+                        res->mol_moments_of_inertia[3 * i + abc] +=
+                            block_moments[abc];
+                        res->mol_moments_of_inertia_squared[3 * i + abc] +=
+                            block_moments[3 + abc];
+                    }
+                    res->mol_coriolis[i] += block_moments[6];
+                    if (stores) {
+                        size_t h = mols_moltypenr[i];
+                        for (size_t abc = 0; abc < 3; abc++) {
+                            moltypes_block_moments[0][3 * h + abc] +=
+                                block_moments[abc];
+                            moltypes_block_moments[1][3 * h + abc] +=
+                                block_moments[3 + abc];
+                        }
+                        moltypes_block_moments[2][h] += block_moments[6];
+                    }
+                }
+                if (stores) {
+                    block_store_append(
+                        &stores[r], res->sample,
+                        frame0 + first - res->nblocksteps, res->nfrequencies,
+                        moltypes_dos_block, cross_spectra_block,
+                        moltypes_block_moments[0], moltypes_block_moments[1],
+                        moltypes_block_moments[2]);
+                    free(moltypes_dos_block);
+                    free(cross_spectra_block);
+                    for (size_t m = 0; m < 3; m++) {
+                        free(moltypes_block_moments[m]);
+                    }
+                }
+
+                // end of the sample, after nblocks blocks or once the
+                // spectra are converged
+                bool converged =
+                    arguments.tolerance > 0.0 &&
+                    block_resolution_converged(
+                        res, nmoltypes * ndos, res->nfrequencies,
+                        res->moltypes_dos_samples, arguments.tolerance);
+                if (res->block + 1 == res->nblocks || converged) {
+                    if (converged) {
+                        verbPrintf(verbosity,
+                                   "sample %zu converged after %zu blocks\n",
+                                   res->sample, res->block + 1);
+                    }
+                    // divide moi and coriolis by number of blocks and number
+                    // of blocksteps
+                    real norm = 1.0 / (real)(res->block + 1) / (real)n;
+                    CBLAS(scal)(nmols * 3, norm, res->mol_moments_of_inertia,
+                                1);
+                    CBLAS(scal)(nmols * 3, norm,
+                                res->mol_moments_of_inertia_squared, 1);
+                    CBLAS(scal)(nmols, norm, res->mol_coriolis, 1);
+
+                    // moi and coriolis summation over all molecules (this
+                    // sample)
+                    for (size_t i = 0; i < nmols; i++) {
+                        for (size_t abc = 0; abc < 3; abc++) {
+                            size_t moi_index = mols_moltypenr[i] *
+                                                   res->nsamples * 3 +
+                                               res->sample * 3 + abc;
+                            res->moltypes_samples_moments_of_inertia
+                                [moi_index] +=
+                                res->mol_moments_of_inertia[3 * i + abc];
+                            res->moltypes_samples_moments_of_inertia_squared
+                                [moi_index] +=
+                                res->mol_moments_of_inertia_squared[3 * i +
+                                                                    abc];
+                        }
+                        size_t coriolis_index =
+                            mols_moltypenr[i] * res->nsamples + res->sample;
+                        res->moltypes_samples_coriolis[coriolis_index] +=
+                            res->mol_coriolis[i];
+                    }
+                    memset(res->mol_moments_of_inertia, 0,
+                           nmols * 3 * sizeof(real));
+                    memset(res->mol_moments_of_inertia_squared, 0,
+                           nmols * 3 * sizeof(real));
+                    memset(res->mol_coriolis, 0, nmols * sizeof(real));
+                    verbPrintf(verbosity, "finished sample %zu\n",
+                               res->sample);
+                }
+                next_block(res, nseries, converged);
             }
         }
-        // coriolis summation over all molecules (this sample)
-        for (size_t i = 0; i < nmols; i++) {
-            size_t coriolis_index = mols_moltypenr[i] * nsamples + sample;
-            moltypes_samples_coriolis[coriolis_index] += mol_coriolis[i];
-        }
-        free(mol_moments_of_inertia);
-        free(mol_moments_of_inertia_squared);
-        free(mol_coriolis);
+
+        // TIMING: fft end
+        timings[3] += omp_get_wtime() - begin;
+        begin = omp_get_wtime();
     }
-    verbPrintf(verbosity, "finished all samples\n");
+    verbPrintf(verbosity, "finished all samples after %lu frames\n",
+               frame0 < nframes ? frame0 : nframes);
     chfl_trajectory_close(file);
-
-    // divide moi by nmols
-    for (size_t h = 0; h < nmoltypes; h++) {
-        cblas_sscal(3 * nsamples, 1.0 / (float)moltypes_nmols[h],
-                    &moltypes_samples_moments_of_inertia[h * nsamples * 3], 1);
+    free(block_pos);
+    free(block_vel);
+    free(block_box);
+    for (size_t s = 0; s < NBLOCK_SERIES; s++) {
+        free(chunk_series[s]);
     }
-    // divide moi squares by nmols
-    for (size_t h = 0; h < nmoltypes; h++) {
-        cblas_sscal(
-            3 * nsamples, 1.0 / (float)moltypes_nmols[h],
-            &moltypes_samples_moments_of_inertia_squared[h * nsamples * 3], 1);
+
+    // keep plans for the next run
+    if (arguments.fftw_wisdom) {
+        if (!FFT(export_wisdom_to_filename)(arguments.fftw_wisdom)) {
+            fprintf(stderr, "WARNING: Could not export FFTW wisdom to %s\n",
+                    arguments.fftw_wisdom);
+        }
     }
-    // calculate std. deviation of moi
-    for (size_t q = 0; q < nmoltypes * nsamples * 3; q++) {
-        moltypes_samples_moments_of_inertia_std[q] =
-            sqrtf(moltypes_samples_moments_of_inertia_squared[q] -
-                  powf(moltypes_samples_moments_of_inertia[q], 2.0));
+    free_fft_plan_cache(&plan_cache);
+
+    for (size_t r = 0; r < nresolutions; r++) {
+        block_resolution *res = &resolutions[r];
+        size_t nsamples = res->nsamples;
+        unsigned long nfftsteps = res->nfftsteps;
+        unsigned long nfftpoints = res->nfftpoints;
+        unsigned long nfrequencies = res->nfrequencies;
+
+        // divide moi by nmols (the number processed if subsampled)
+        for (size_t h = 0; h < nmoltypes; h++) {
+            CBLAS(scal)(
+                3 * nsamples, 1.0 / (real)moltypes_nselected[h],
+                &res->moltypes_samples_moments_of_inertia[h * nsamples * 3],
+                1);
+        }
+        // divide moi squares by nmols
+        for (size_t h = 0; h < nmoltypes; h++) {
+            CBLAS(scal)(3 * nsamples, 1.0 / (real)moltypes_nselected[h],
+                        &res->moltypes_samples_moments_of_inertia_squared
+                             [h * nsamples * 3],
+                        1);
+        }
+        // calculate std. deviation of moi
+        for (size_t q = 0; q < nmoltypes * nsamples * 3; q++) {
+            res->moltypes_samples_moments_of_inertia_std[q] =
+                sqrt(res->moltypes_samples_moments_of_inertia_squared[q] -
+                     pow(res->moltypes_samples_moments_of_inertia[q], 2.0));
+        }
+
+        // average Coriolis energy term
+        for (size_t h = 0; h < nmoltypes; h++) {
+            CBLAS(scal)(nsamples, 1.0 / (real)moltypes_nselected[h],
+                        &res->moltypes_samples_coriolis[h * nsamples], 1);
+        }
+
+        // standard error of the subsampled spectra from the spread of the
+        // block spectra, normalized below like the spectra
+        if (res->moltypes_dos_m2_samples) {
+            res->moltypes_dos_std_error_samples = calloc(
+                nmoltypes * ndos * nsamples * nfrequencies, sizeof(real));
+            calc_block_std_error(nmoltypes * ndos, nsamples, nfrequencies,
+                                 res->samples_nblocks,
+                                 res->moltypes_dos_m2_samples,
+                                 res->moltypes_dos_std_error_samples);
+        }
+
+        // mean over the blocks of each sample (fewer than nblocks if it
+        // converged early)
+        average_sample_blocks(res, nmoltypes * ndos, nfrequencies,
+                              res->moltypes_dos_samples);
+        average_sample_blocks(res, ncross_spectra, nfrequencies,
+                              res->cross_spectra_samples);
+
+        // correlation functions from the accumulated spectra, up to half
+        // the block length
+        if (arguments.correlations != 'n') {
+            res->nlags = nfftsteps / 2 + 1;
+            unsigned long nlags = res->nlags;
+            real *lag_weights = malloc(nlags * sizeof(real));
+            calc_window_lag_weights(nfftsteps, res->window_weights,
+                                    nfftpoints, nlags, lag_weights);
+            res->moltypes_correlation_samples =
+                calloc(nmoltypes * ndos * nsamples * nlags, sizeof(real));
+            res->cross_correlation_samples =
+                calloc(ncross_spectra * nsamples * nlags, sizeof(real));
+            for (size_t h = 0; h < nmoltypes; h++) {
+                size_t dos_index = h * ndos * nsamples * nfrequencies;
+                size_t correlation_index = h * ndos * nsamples * nlags;
+                calc_correlations(
+                    ndos * nsamples, nfftpoints, nfrequencies, nlags,
+                    lag_weights, 1.0 / (real)moltypes_nselected[h],
+                    &res->moltypes_dos_samples[dos_index],
+                    &res->moltypes_correlation_samples[correlation_index]);
+            }
+            calc_correlations(ncross_spectra * nsamples, nfftpoints,
+                              nfrequencies, nlags, lag_weights, 1.0,
+                              res->cross_spectra_samples,
+                              res->cross_correlation_samples);
+            free(lag_weights);
+        }
+
+        // normalize dos
+        // zero padding adds no power, so the DFT is normalized by the number
+        // of frames nfftsteps, not by nfftpoints
+        for (size_t h = 0; h < nmoltypes; h++) {
+            // normalize DFT, window and nmols
+            real norm_factor = fft_framelength / (real)nfftsteps;
+            norm_factor /= res->window_power;
+            norm_factor /= (real)moltypes_nselected[h];
+            size_t dos_index = h * ndos * nsamples * nfrequencies;
+            CBLAS(scal)(ndos * nsamples * nfrequencies, norm_factor,
+                        &res->moltypes_dos_samples[dos_index], 1);
+            if (res->moltypes_dos_std_error_samples) {
+                CBLAS(scal)(ndos * nsamples * nfrequencies, norm_factor,
+                            &res->moltypes_dos_std_error_samples[dos_index],
+                            1);
+            }
+        }
+
+        // normalize cross spectra
+        real norm_factor = fft_framelength / (real)nfftsteps;
+        norm_factor /= res->window_power;
+        CBLAS(scal)(ncross_spectra * nsamples * nfrequencies, norm_factor,
+                    &res->cross_spectra_samples[0], 1);
+
+        // only the band up to max_frequency is written
+        truncate_spectra(nmoltypes * ndos * nsamples, nfrequencies,
+                         res->nfrequencies_retained,
+                         res->moltypes_dos_samples);
+        truncate_spectra(ncross_spectra * nsamples, nfrequencies,
+                         res->nfrequencies_retained,
+                         res->cross_spectra_samples);
+        if (res->moltypes_dos_std_error_samples) {
+            truncate_spectra(nmoltypes * ndos * nsamples, nfrequencies,
+                             res->nfrequencies_retained,
+                             res->moltypes_dos_std_error_samples);
+        }
     }
 
-    // average Coriolis energy term
-    for (size_t h = 0; h < nmoltypes; h++) {
-        cblas_sscal(nsamples, 1.0 / (float)moltypes_nmols[h],
-                    &moltypes_samples_coriolis[h * nsamples], 1);
+    // write dos.npz, one prefix per block length if there are several
+    if (arguments.format == 'n') {
+        npz_writer npz;
+        if (npz_open(&npz, arguments.outfile) != 0) {
+            fprintf(stderr, "ERROR: Could not open %s for writing.\n",
+                    arguments.outfile);
+            exit(1);
+        }
+        for (size_t r = 0; r < nresolutions; r++) {
+            block_resolution *res = &resolutions[r];
+            char prefix[32] = "";
+            if (nresolutions > 1) {
+                sprintf(prefix, "resolution%zu/", r);
+            }
+            write_dos_npz(
+                &npz, prefix, res->nsamples,
+                arguments.tolerance > 0.0 ? res->samples_nblocks : NULL,
+                res->nblocksteps, res->nfftpoints,
+                res->nfrequencies_retained, fft_framelength, ndos,
+                ncross_spectra, dos_names, nmoltypes,
+                res->moltypes_dos_samples, moltypes_nmols, moltypes_nselected,
+                res->moltypes_dos_std_error_samples,
+                res->cross_spectra_samples,
+                res->moltypes_samples_moments_of_inertia,
+                res->moltypes_samples_moments_of_inertia_std,
+                cross_spectra_def, res->moltypes_samples_coriolis,
+                res->nlags, fft_framelength,
+                res->moltypes_correlation_samples,
+                res->cross_correlation_samples);
+        }
+        if (npz_close(&npz) != 0) {
+            fprintf(stderr, "ERROR: Could not write npz to file.\n");
+            exit(1);
+        }
     }
 
-    // normalize dos
-    for (size_t h = 0; h < nmoltypes; h++) {
-        float norm_factor = 1.0 / (float)nblocks;        // normalize for blocks
-        norm_factor *= framelength / (float)nblocksteps; // normalize DFT
-        norm_factor /= (float)moltypes_nmols[h];         // normalize nmols
-        size_t dos_index = h * ndos * nsamples * nfrequencies;
-        cblas_sscal(ndos * nsamples * nfrequencies, norm_factor,
-                    &moltypes_dos_samples[dos_index], 1);
+    // write dos.json, streamed element by element
+    // several block lengths go into separate sections of "resolutions"
+    if (arguments.format == 'j') {
+        json_writer writer;
+        if (json_open(&writer, arguments.outfile) != 0) {
+            fprintf(stderr, "ERROR: Could not open %s for writing.\n",
+                    arguments.outfile);
+            exit(1);
+        }
+        json_begin_object(&writer, NULL);
+        if (nresolutions > 1) {
+            json_begin_array(&writer, "resolutions");
+        }
+        for (size_t r = 0; r < nresolutions; r++) {
+            block_resolution *res = &resolutions[r];
+            if (nresolutions > 1) {
+                json_begin_object(&writer, NULL);
+            }
+            write_dos_json(
+                &writer, res->nsamples,
+                arguments.tolerance > 0.0 ? res->samples_nblocks : NULL,
+                res->nfftpoints, res->nfrequencies_retained,
+                fft_framelength, ndos, ncross_spectra, dos_names, nmoltypes,
+                res->moltypes_dos_samples, moltypes_nmols, moltypes_nselected,
+                res->moltypes_dos_std_error_samples,
+                res->cross_spectra_samples,
+                res->moltypes_samples_moments_of_inertia,
+                res->moltypes_samples_moments_of_inertia_std,
+                cross_spectra_def, res->moltypes_samples_coriolis,
+                res->nlags, fft_framelength,
+                res->moltypes_correlation_samples,
+                res->cross_correlation_samples);
+            if (nresolutions > 1) {
+                json_integer(&writer, "nblocksteps", res->nblocksteps);
+                json_end_object(&writer);
+            }
+        }
+        if (nresolutions > 1) {
+            json_end_array(&writer);
+        }
+        json_end_object(&writer);
+        if (json_close(&writer) != 0) {
+            fprintf(stderr, "ERROR: Could not write json to file.\n");
+            exit(1);
+        }
     }
 
-    // normalize cross spectra
-    float norm_factor = 1.0 / (float)nblocks;
-    norm_factor *= framelength / (float)nblocksteps;
-    cblas_sscal(ncross_spectra * nsamples * nfrequencies, norm_factor,
-                &cross_spectra_samples[0], 1);
-
-    // write dos.json
-    result = write_dos(arguments.outfile, nsamples, nblocksteps, nfrequencies,
-                       framelength, ndos, ncross_spectra, dos_names, nmoltypes,
-                       moltypes_dos_samples, cross_spectra_samples,
-                       moltypes_samples_moments_of_inertia,
-                       moltypes_samples_moments_of_inertia_std,
-                       cross_spectra_def, moltypes_samples_coriolis);
-    if (result != 0) {
-        fprintf(stderr, "ERROR: Could not write json to file.\n");
-        exit(1);
+    // write the block store, prefixes like dos.npz
+    if (stores) {
+        npz_writer npz;
+        if (npz_open(&npz, arguments.block_store) != 0) {
+            fprintf(stderr, "ERROR: Could not open %s for writing.\n",
+                    arguments.block_store);
+            exit(1);
+        }
+        for (size_t r = 0; r < nresolutions; r++) {
+            block_resolution *res = &resolutions[r];
+            char prefix[32] = "";
+            if (nresolutions > 1) {
+                sprintf(prefix, "resolution%zu/", r);
+            }
+            real spectra_norm =
+                fft_framelength / (real)res->nfftsteps / res->window_power;
+            write_block_store(&npz, prefix, &stores[r], res->nblocksteps,
+                              res->nblocks, res->nfftpoints, fft_framelength,
+                              framelength, arguments.skip_frames,
+                              spectra_norm, dos_names,
+                              cross_spectra_def, moltypes_nmols,
+                              moltypes_nselected);
+            free_block_store(&stores[r]);
+        }
+        if (npz_close(&npz) != 0) {
+            fprintf(stderr, "ERROR: Could not write the block store.\n");
+            exit(1);
+        }
+        free(stores);
     }
 
     // free output
-    free(moltypes_dos_samples);
-    free(cross_spectra_samples);
-    free(moltypes_samples_moments_of_inertia);
-    free(moltypes_samples_moments_of_inertia_squared);
-    free(moltypes_samples_moments_of_inertia_std);
-    free(moltypes_samples_coriolis);
+    for (size_t r = 0; r < nresolutions; r++) {
+        free_block_resolution(&resolutions[r]);
+    }
+    free(resolutions);
 
     // free input arrays
-    free_dosparams_arrays(nmoltypes, &moltypes_nmols, &moltypes_natomspermol,
+    free_dosparams_arrays(&nsamples, &nblocks, &nblocksteps, nmoltypes,
+                          &moltypes_nmols, &moltypes_nselected,
+                          &moltypes_natomspermol,
                           &moltypes_atommasses, &moltypes_rot_treat,
                           &moltypes_abc_indicators, &ncross_spectra,
                           &cross_spectra_def);
@@ -496,11 +1069,19 @@ int main(int argc, char *argv[]) {
     free(mols_natoms);
     free(mols_mass);
     free(mols_firstatom);
+    free(moltypes_decomposition_cost);
+    free(moltypes_fft_cost);
+    free(mols_order_decomposition);
+    free(mols_order_fft);
+    free(mols_selected);
+    free(fft_work_items);
+    free_dof_fourier_map(nmoltypes, &fourier_map);
 
     // free other
     chfl_free(frame);
     free(refconf_pos);
     free(refconf_box);
+    free(lowpass_taps);
     free(atom_refpos_principal_components);
 
     // TIMING: write end
@@ -1,273 +1,590 @@
+#include "cpu-dispatch.c"
+#include "cross-spectra.c"
+#include "fft-backend.h"
+#include "load-balancing.c"
+#include "precision.h"
 #include "structs.h"
 #include <cblas.h>
 #include <complex.h>
-#include <fftw3.h>
-#include <math.h>
+#include <omp.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <tgmath.h>
 
-size_t gen_dof_fourier_index(unsigned long nfrequencies,
-                             size_t *moltype_firstmol,
-                             size_t *moltype_firstatom,
-                             size_t *moltype_natomspermol,
-                             size_t moltype, // query variables
-                             char type, size_t dof, size_t i0) {
-    size_t mol_natoms = moltype_natomspermol[moltype];
-    size_t trn_start = 0;
-    size_t rot_xyz_start = 3;
-    size_t vib_start = rot_xyz_start + 3 * mol_natoms;
-    size_t rot_omega_start = vib_start + 3 * mol_natoms;
-    size_t vibc_start = rot_omega_start + 3;
-
-    // add specified type
-    size_t dof_index = 0;
-    if (type == 't')
-        dof_index += trn_start;
-    else if (type == 'r')
-        dof_index += rot_xyz_start;
-    else if (type == 'v')
-        dof_index += vib_start;
-    else if (type == 'o')
-        dof_index += rot_omega_start;
-    else if (type == 'c')
-        dof_index += vibc_start;
-    else {
-        fprintf(stderr, "ERROR: unknown cross spectrum dof_type: '%c'\n", type);
+// number of series (whole atoms) transformed by one batched plan execution
+#define FFT_BATCH_NSERIES 24
+
+// number of complex values between two transforms in dof_fourier
+// nfrequencies rounded up to a multiple of 16 bytes
+size_t calc_fourier_stride(unsigned long nfrequencies) {
+    size_t align = 16 / sizeof(FFT(complex));
+    if (align < 1) {
+        align = 1;
+    }
+    return (nfrequencies + align - 1) / align * align;
+}
+
+// plan for nseries real series of nblocksteps, stored one after another,
+// whose transforms are stored fourier_stride apart
+FFT(plan) plan_r2c_series(unsigned long nblocksteps, size_t nseries,
+                           size_t fourier_stride, unsigned plan_flags) {
+    // planning with FFT_MEASURE overwrites the arrays, use scratch ones
+    real *plan_in = FFT(malloc)(sizeof(real) * nseries * nblocksteps);
+    FFT(complex) *plan_out =
+        FFT(malloc)(sizeof(FFT(complex)) * nseries * fourier_stride);
+    int n = nblocksteps;
+    FFT(plan) plan = FFT(plan_many_dft_r2c)(
+        1, &n, nseries, plan_in, NULL, 1, nblocksteps, plan_out, NULL, 1,
+        fourier_stride, plan_flags);
+    FFT(free)(plan_in);
+    FFT(free)(plan_out);
+    if (plan == NULL) {
+        fprintf(stderr, "ERROR: could not create an FFT plan.\n");
         exit(1);
     }
+    return plan;
+}
+
+// plan for one complex transform of two real series packed as real and
+// imaginary part (split arrays, so the series need not be copied)
+FFT(plan) plan_split_series(unsigned long nblocksteps, unsigned plan_flags) {
+    real *plan_arrays = FFT(malloc)(sizeof(real) * 4 * nblocksteps);
+    FFT(iodim) dim = {nblocksteps, 1, 1};
+    FFT(plan) plan = FFT(plan_guru_split_dft)(
+        1, &dim, 0, NULL, plan_arrays, &plan_arrays[nblocksteps],
+        &plan_arrays[2 * nblocksteps], &plan_arrays[3 * nblocksteps],
+        plan_flags);
+    FFT(free)(plan_arrays);
+    if (plan == NULL) {
+        fprintf(stderr, "ERROR: could not create an FFT plan.\n");
+        exit(1);
+    }
+    return plan;
+}
+
+// plans are created once per run (not per block) and looked up by size and
+// layout
+typedef struct {
+    char kind; // 'r' batched r2c, 's' split complex
+    unsigned long nblocksteps;
+    size_t nseries;
+    size_t fourier_stride;
+    unsigned plan_flags;
+    FFT(plan) plan;
+} fft_plan_cache_entry;
+
+typedef struct {
+    unsigned planner_effort; // FFT_ESTIMATE, FFT_MEASURE or FFT_PATIENT
+    size_t nentries;
+    fft_plan_cache_entry *entries;
+} fft_plan_cache;
+
+void init_fft_plan_cache(fft_plan_cache *plan_cache, unsigned planner_effort) {
+    plan_cache->planner_effort = planner_effort;
+    plan_cache->nentries = 0;
+    plan_cache->entries = NULL;
+}
+
+// not thread safe (FFTW planner), call outside of parallel regions
+// for kind 's' nseries and fourier_stride are ignored
+FFT(plan) get_fft_plan(fft_plan_cache *plan_cache, char kind,
+                        unsigned long nblocksteps, size_t nseries,
+                        size_t fourier_stride, bool aligned) {
+    if (kind == 's') {
+        nseries = 1;
+        fourier_stride = 0;
+    }
+    unsigned plan_flags =
+        plan_cache->planner_effort | (aligned ? 0 : FFT_UNALIGNED);
+    for (size_t e = 0; e < plan_cache->nentries; e++) {
+        fft_plan_cache_entry *entry = &plan_cache->entries[e];
+        if (entry->kind == kind && entry->nblocksteps == nblocksteps &&
+            entry->nseries == nseries &&
+            entry->fourier_stride == fourier_stride &&
+            entry->plan_flags == plan_flags) {
+            return entry->plan;
+        }
+    }
+    plan_cache->entries =
+        realloc(plan_cache->entries,
+                (plan_cache->nentries + 1) * sizeof(fft_plan_cache_entry));
+    fft_plan_cache_entry *entry = &plan_cache->entries[plan_cache->nentries];
+    entry->kind = kind;
+    entry->nblocksteps = nblocksteps;
+    entry->nseries = nseries;
+    entry->fourier_stride = fourier_stride;
+    entry->plan_flags = plan_flags;
+    if (kind == 's') {
+        entry->plan = plan_split_series(nblocksteps, plan_flags);
+    } else {
+        entry->plan =
+            plan_r2c_series(nblocksteps, nseries, fourier_stride, plan_flags);
+    }
+    plan_cache->nentries++;
+    return entry->plan;
+}
+
+void free_fft_plan_cache(fft_plan_cache *plan_cache) {
+    for (size_t e = 0; e < plan_cache->nentries; e++) {
+        FFT(destroy_plan)(plan_cache->entries[e].plan);
+    }
+    free(plan_cache->entries);
+    plan_cache->nentries = 0;
+    plan_cache->entries = NULL;
+}
+
+// FFT_ESTIMATE, FFT_MEASURE or FFT_PATIENT from its name
+// (FFT_MEASURE is 0), returns false if the name is unknown
+bool parse_planner_effort(const char *name,
+                          unsigned *planner_effort) { // output
+    if (strcmp(name, "ESTIMATE") == 0)
+        *planner_effort = FFT_ESTIMATE;
+    else if (strcmp(name, "MEASURE") == 0)
+        *planner_effort = FFT_MEASURE;
+    else if (strcmp(name, "PATIENT") == 0)
+        *planner_effort = FFT_PATIENT;
+    else
+        return false;
+    return true;
+}
+
+// sum the thread private arrays of all threads into the one of thread 0
+// pairwise in log2(nthreads) steps, call from all threads of a parallel
+// region after each has stored its array in thread_arrays
+void tree_reduce_thread_arrays(size_t n, real **thread_arrays) {
+    int thread = omp_get_thread_num();
+    int nthreads = omp_get_num_threads();
+    for (int step = 1; step < nthreads; step *= 2) {
+#pragma omp barrier
+        if (thread % (2 * step) == 0 && thread + step < nthreads) {
+            CBLAS(axpy)(n, 1.0, thread_arrays[thread + step], 1,
+                        thread_arrays[thread], 1);
+        }
+    }
+#pragma omp barrier
+}
 
-    // add specified dof
-    dof_index += dof;
+// add the power spectrum |X|^2 of one fourier transform to spectrum
+CPU_DISPATCH
+void accumulate_power_spectrum(unsigned long nfrequencies,
+                               FFT(complex) *fourier, real *spectrum) {
+    for (unsigned long t = 0; t < nfrequencies; t++) {
+        real re = creal(fourier[t]);
+        real im = cimag(fourier[t]);
+        spectrum[t] += re * re + im * im;
+    }
+}
 
-    size_t dof_fourier_index =
-        nfrequencies *
-        (6 * moltype_firstmol[moltype] + 6 * moltype_firstatom[moltype] +
-         6 * i0 + 6 * mol_natoms * i0 + dof_index);
-    return dof_fourier_index;
+// separate the transform Z of two real series packed as a + ib
+// A_k = (Z_k + Z*_{n-k}) / 2 and B_k = (Z_k - Z*_{n-k}) / 2i
+// gives the same as r2c transforms of a and b
+CPU_DISPATCH
+void separate_packed_transforms(unsigned long nblocksteps,
+                                unsigned long nfrequencies, real *packed_re,
+                                real *packed_im, FFT(complex) *fourierA,
+                                FFT(complex) *fourierB) {
+    for (unsigned long k = 0; k < nfrequencies; k++) {
+        unsigned long m = k == 0 ? 0 : nblocksteps - k;
+        real re_sum = 0.5 * (packed_re[k] + packed_re[m]);
+        real re_diff = 0.5 * (packed_re[k] - packed_re[m]);
+        real im_sum = 0.5 * (packed_im[k] + packed_im[m]);
+        real im_diff = 0.5 * (packed_im[k] - packed_im[m]);
+        fourierA[k] = re_sum + I * im_diff;
+        fourierB[k] = im_sum - I * re_diff;
+    }
 }
 
+// transform two real series with one complex FFT, store both transforms
+// and add their power spectra
+void transform_series_pair(FFT(plan) plan_split, unsigned long nblocksteps,
+                           unsigned long nfrequencies, real *seriesA,
+                           real *seriesB, real *packed_re, real *packed_im,
+                           FFT(complex) *fourierA, FFT(complex) *fourierB,
+                           real *spectrumA, real *spectrumB) {
+    FFT(execute_split_dft)(plan_split, seriesA, seriesB, packed_re, packed_im);
+    separate_packed_transforms(nblocksteps, nfrequencies, packed_re, packed_im,
+                               fourierA, fourierB);
+    accumulate_power_spectrum(nfrequencies, fourierA, spectrumA);
+    accumulate_power_spectrum(nfrequencies, fourierB, spectrumB);
+}
+
+// adds the spectra of block (counted from 0) to sample of the outputs,
+// optional (NULL if not needed): the squared deviations of the spectra from
+// the mean of the sample's blocks (Welford) and the spectra of the block
+// alone ([moltype][dos][frequency] and [cross spectrum][frequency], the
+// latter zeroed by the caller)
 void dos_calculation(
     size_t nmoltypes, unsigned long nblocksteps, unsigned long nfrequencies,
-    size_t *moltype_firstmol, size_t *moltype_firstatom, size_t *moltype_nmols,
-    size_t *moltype_natomspermol, float *mol_velocities_sqrt_m_trn,
-    float *mol_omegas_sqrt_i_rot, float *atom_velocities_sqrt_m_vib,
-    float *atom_velocities_sqrt_m_rot, float *atom_velocities_sqrt_m_vibc,
-    size_t ndos, size_t nsamples, size_t sample, size_t ncross_spectra,
-    cross_spectrum_def *cross_spectra_def,
-    float *moltypes_dos_samples, // output
-    float *cross_spectra_samples) {
-    // finding the number of dof
-    size_t ndof = 0;
-    for (size_t h = 0; h < nmoltypes; h++) {
-        // trn and rot_omega
-        ndof += 6 * moltype_nmols[h];
-        // vib and rot_xyz and vibc
-        ndof += 9 * moltype_nmols[h] * moltype_natomspermol[h];
+    size_t *moltype_firstmol, size_t *moltype_firstatom,
+    size_t *moltype_natomspermol, char *moltype_rot_treat,
+    size_t *mols_moltypenr, size_t nfft_work_items,
+    fft_work_item *fft_work_items, fft_plan_cache *plan_cache,
+    char fft_packing, dof_fourier_map *fourier_map,
+    real *mol_velocities_sqrt_m_trn,
+    real *mol_omegas_sqrt_i_rot, real *atom_velocities_sqrt_m_vib,
+    real *atom_velocities_sqrt_m_rot, real *atom_velocities_sqrt_m_vibc,
+    size_t ndos, size_t nsamples, size_t sample, size_t block,
+    cross_spectra_plan *cross_plan,
+    real *moltypes_dos_samples, // output
+    real *moltypes_dos_m2_samples, real *cross_spectra_samples,
+    real *moltypes_dos_block, real *cross_spectra_block) {
+    // array that will hold the FT of the time series needed for the cross
+    // spectra later (see dof_fourier_map), nothing without cross spectra
+    // every transform starts at a 16 byte boundary, so that FFTW may write
+    // them with SIMD directly
+    size_t fourier_stride = calc_fourier_stride(nfrequencies);
+    FFT(complex) *dof_fourier = NULL;
+    if (fourier_map->nslots > 0) {
+        dof_fourier = FFT(malloc)(fourier_map->nslots * fourier_stride *
+                                   sizeof(FFT(complex)));
     }
 
-    // array that will hold all FT of the time series
-    // this is for cross spectra calculation later
-    // order of dof is: trn rot_xyz vib rot_omega
-    fftwf_complex *dof_fourier =
-        calloc(ndof * nfrequencies, sizeof(fftwf_complex));
-
     // stuff for fftw
-    float *fft_in = calloc(nblocksteps, sizeof(float));
-    fftwf_complex *fft_out = fftwf_malloc(sizeof(fftwf_complex) * nfrequencies);
-    float *fft_out_squared = calloc(nfrequencies, sizeof(float));
-    fftwf_plan plan =
-        fftwf_plan_dft_r2c_1d(nblocksteps, fft_in, fft_out, FFTW_MEASURE);
+    // series are transformed in batches straight out of the decomposition
+    // arrays, SIMD codelets may only be used if all of them are aligned
+    bool aligned = (nblocksteps * sizeof(real)) % 16 == 0 &&
+                   FFT(alignment_of)(mol_velocities_sqrt_m_trn) == 0 &&
+                   FFT(alignment_of)(mol_omegas_sqrt_i_rot) == 0 &&
+                   FFT(alignment_of)(atom_velocities_sqrt_m_vib) == 0 &&
+                   FFT(alignment_of)(atom_velocities_sqrt_m_rot) == 0 &&
+                   FFT(alignment_of)(atom_velocities_sqrt_m_vibc) == 0;
+    // the plans are shared, every thread executes them on its own series
+    FFT(plan) plan_batch = get_fft_plan(plan_cache, 'r', nblocksteps,
+                                         FFT_BATCH_NSERIES, fourier_stride,
+                                         aligned);
+    FFT(plan) plan_xyz =
+        get_fft_plan(plan_cache, 'r', nblocksteps, 3, fourier_stride, aligned);
+    // two-for-one transforms of series pairs (fft_packing)
+    // 'x' consecutive series, 'a' same component of consecutive atoms,
+    // 'm' same dof of two molecules (only every other molecule has work)
+    FFT(plan) plan_split = NULL;
+    FFT(plan) plan_single = NULL;
+    if (fft_packing != 'n') {
+        plan_split =
+            get_fft_plan(plan_cache, 's', nblocksteps, 1, 0, aligned);
+        plan_single = get_fft_plan(plan_cache, 'r', nblocksteps, 1,
+                                   fourier_stride, aligned);
+    }
+
+    // thread private accumulators, known to all threads for the reduction
+    real **thread_doses = calloc(omp_get_max_threads(), sizeof(real *));
 
     // fourier all dof
-    for (size_t h = 0; h < nmoltypes; h++) {
+    // work items (molecules or parts of large molecules) in order of
+    // descending cost, scheduled dynamically
+#pragma omp parallel
+    {
+        // thread private dos
+        real *thread_dos =
+            calloc(nmoltypes * ndos * nfrequencies, sizeof(real));
+        // thread private output of transforms that are not stored
+        FFT(complex) *thread_fourier = FFT(malloc)(
+            FFT_BATCH_NSERIES * fourier_stride * sizeof(FFT(complex)));
+        // thread private output of packed transforms
+        real *packed_re = NULL;
+        real *packed_im = NULL;
+        if (fft_packing != 'n') {
+            packed_re = FFT(malloc)(sizeof(real) * nblocksteps);
+            packed_im = FFT(malloc)(sizeof(real) * nblocksteps);
+        }
 
-        size_t first_mol = moltype_firstmol[h];
-        size_t last_mol = moltype_firstmol[h] + moltype_nmols[h];
-        for (size_t i = first_mol; i < last_mol; i++) {
+#pragma omp for schedule(dynamic, 1)
+        for (size_t k = 0; k < nfft_work_items; k++) {
+            size_t i = fft_work_items[k].mol;
+            size_t h = mols_moltypenr[i];
             size_t i0 = i - moltype_firstmol[h];
 
             // convenience stuff
             size_t mol_natoms = moltype_natomspermol[h];
-            // number of degrees of freedom that will be transformed here
-            // 3 trn, 3*N vib, 3*N rot_xyz, 3*rot_omega, 3*N vib_coupled
-            size_t mol_ndof = 6 + 9 * mol_natoms;
-            size_t trn_start = 0;
-            size_t trn_end = 3;
-            size_t rot_xyz_start = trn_end;
-            size_t rot_xyz_end = trn_end + 3 * mol_natoms;
-            size_t vib_start = rot_xyz_end;
-            size_t vib_end = rot_xyz_end + 3 * mol_natoms;
-            size_t rot_omega_start = vib_end;
-            size_t rot_omega_end = vib_end + 3;
-            size_t vibc_start = rot_omega_end;
-            size_t vibc_end = rot_omega_end + 3 * mol_natoms;
             size_t mol_first_dof_atomic =
                 3 * moltype_firstatom[h] + 3 * i0 * mol_natoms;
-            size_t dos;
-
-            for (size_t dof = 0; dof < mol_ndof; dof++) {
-                size_t xyz = dof % 3;
-                if ((dof >= trn_start) && (dof < trn_end)) {
-                    memcpy(
-                        fft_in,
-                        &mol_velocities_sqrt_m_trn[(3 * i + xyz) * nblocksteps],
-                        nblocksteps * sizeof(float));
-                    dos = 0 + xyz;
-                }
-                if ((dof >= rot_xyz_start) && (dof < rot_xyz_end)) {
-                    size_t dof_rot = dof - rot_xyz_start;
-                    memcpy(fft_in,
-                           &atom_velocities_sqrt_m_rot
-                               [(mol_first_dof_atomic + dof_rot) * nblocksteps],
-                           nblocksteps * sizeof(float));
-                    dos = 3 + xyz;
-                }
-                if ((dof >= vib_start) && (dof < vib_end)) {
-                    size_t d_vib = dof - vib_start;
-                    memcpy(fft_in,
-                           &atom_velocities_sqrt_m_vib
-                               [(mol_first_dof_atomic + d_vib) * nblocksteps],
-                           nblocksteps * sizeof(float));
-                    dos = 6 + xyz;
-                }
-                if ((dof >= rot_omega_start) && (dof < rot_omega_end)) {
-                    memcpy(fft_in,
-                           &mol_omegas_sqrt_i_rot[(3 * i + xyz) * nblocksteps],
-                           nblocksteps * sizeof(float));
-                    dos = 9 + xyz;
+            // degrees of freedom of the molecule (this work item transforms
+            // first_dof to last_dof of them)
+            // 3 trn, 3*N rot_xyz, 3*N vib, 3 rot_omega, 3*N vib_coupled
+            // each part is contiguous in its decomposition array
+            size_t part_ndof[5] = {3, 3 * mol_natoms, 3 * mol_natoms, 3,
+                                   3 * mol_natoms};
+            real *part_series[5] = {
+                &mol_velocities_sqrt_m_trn[3 * i * nblocksteps],
+                &atom_velocities_sqrt_m_rot[mol_first_dof_atomic * nblocksteps],
+                &atom_velocities_sqrt_m_vib[mol_first_dof_atomic * nblocksteps],
+                &mol_omegas_sqrt_i_rot[3 * i * nblocksteps],
+                &atom_velocities_sqrt_m_vibc[mol_first_dof_atomic *
+                                             nblocksteps]};
+
+            // pairing partner for fft_packing 'm', same dof of the next
+            // molecule (series are one molecule apart)
+            bool pair_mols = fft_work_items[k].pair_next;
+            size_t part_partner_offset[5] = {
+                3 * nblocksteps, 3 * mol_natoms * nblocksteps,
+                3 * mol_natoms * nblocksteps, 3 * nblocksteps,
+                3 * mol_natoms * nblocksteps};
+            // distance of paired series for fft_packing 'x' and 'a'
+            size_t pair_distance = fft_packing == 'x' ? 1 : 3;
+
+            bool zero_parts[5];
+            moltype_zero_dof_parts(mol_natoms, moltype_rot_treat[h],
+                                   zero_parts);
+
+            size_t first_dof = fft_work_items[k].first_dof;
+            size_t last_dof = fft_work_items[k].last_dof;
+            size_t part_start = 0;
+            for (size_t part = 0; part < 5; part++) {
+                size_t part_end = part_start + part_ndof[part];
+                size_t dof = first_dof > part_start ? first_dof : part_start;
+                size_t end = last_dof < part_end ? last_dof : part_end;
+                size_t dos_index = h * ndos * nfrequencies +
+                                   3 * part * nfrequencies;
+                if (dof < end && zero_parts[part]) {
+                    // nothing to transform or add to the dos
+                    for (; dof < end; dof++) {
+                        for (size_t m = 0; m < (pair_mols ? 2 : 1); m++) {
+                            FFT(complex) *fourier =
+                                stored_fourier(fourier_map, dof_fourier,
+                                               fourier_stride, h, i0 + m, dof);
+                            if (fourier) {
+                                memset(fourier, 0,
+                                       nfrequencies * sizeof(FFT(complex)));
+                            }
+                        }
+                    }
+                    part_start = part_end;
+                    continue;
                 }
-                if ((dof >= vibc_start) && (dof < vibc_end)) {
-                    size_t d_vibc = dof - vibc_start;
-                    memcpy(fft_in,
-                           &atom_velocities_sqrt_m_vibc
-                               [(mol_first_dof_atomic + d_vibc) * nblocksteps],
-                           nblocksteps * sizeof(float));
-                    dos = 12 + xyz;
+                real *series = part_series[part];
+                if (fft_packing == 'm' && pair_mols) {
+                    for (; dof < end; dof++) {
+                        size_t s = dof - part_start;
+                        size_t dos_xyz = dos_index + (s % 3) * nfrequencies;
+                        FFT(complex) *fourierA =
+                            stored_fourier(fourier_map, dof_fourier,
+                                           fourier_stride, h, i0, dof);
+                        FFT(complex) *fourierB =
+                            stored_fourier(fourier_map, dof_fourier,
+                                           fourier_stride, h, i0 + 1, dof);
+                        transform_series_pair(
+                            plan_split, nblocksteps, nfrequencies,
+                            &series[s * nblocksteps],
+                            &series[s * nblocksteps +
+                                    part_partner_offset[part]],
+                            packed_re, packed_im,
+                            fourierA ? fourierA : thread_fourier,
+                            fourierB ? fourierB
+                                     : &thread_fourier[fourier_stride],
+                            &thread_dos[dos_xyz], &thread_dos[dos_xyz]);
+                    }
+                } else if (fft_packing == 'x' || fft_packing == 'a') {
+                    for (; dof + 2 * pair_distance <= end;
+                         dof += 2 * pair_distance) {
+                        for (size_t c = 0; c < pair_distance; c++) {
+                            size_t sA = dof + c - part_start;
+                            size_t sB = sA + pair_distance;
+                            FFT(complex) *fourierA =
+                                stored_fourier(fourier_map, dof_fourier,
+                                               fourier_stride, h, i0, dof + c);
+                            FFT(complex) *fourierB = stored_fourier(
+                                fourier_map, dof_fourier, fourier_stride, h,
+                                i0, dof + c + pair_distance);
+                            transform_series_pair(
+                                plan_split, nblocksteps, nfrequencies,
+                                &series[sA * nblocksteps],
+                                &series[sB * nblocksteps], packed_re, packed_im,
+                                fourierA ? fourierA : thread_fourier,
+                                fourierB ? fourierB
+                                         : &thread_fourier[fourier_stride],
+                                &thread_dos[dos_index +
+                                            (sA % 3) * nfrequencies],
+                                &thread_dos[dos_index +
+                                            (sB % 3) * nfrequencies]);
+                        }
+                    }
+                    // remaining unpaired series
+                    for (; dof < end; dof++) {
+                        size_t s = dof - part_start;
+                        FFT(complex) *fourier =
+                            stored_fourier(fourier_map, dof_fourier,
+                                           fourier_stride, h, i0, dof);
+                        if (!fourier) {
+                            fourier = thread_fourier;
+                        }
+                        FFT(execute_dft_r2c)(
+                            plan_single, &series[s * nblocksteps], fourier);
+                        accumulate_power_spectrum(
+                            nfrequencies, fourier,
+                            &thread_dos[dos_index + (s % 3) * nfrequencies]);
+                    }
                 }
+                while (dof < end) {
+                    // batches of whole atoms, remaining atoms one by one
+                    FFT(plan) plan = plan_xyz;
+                    size_t nseries = 3;
+                    if (end - dof >= FFT_BATCH_NSERIES) {
+                        plan = plan_batch;
+                        nseries = FFT_BATCH_NSERIES;
+                    }
+                    // directly into dof_fourier if all transforms of the
+                    // batch are stored (in consecutive slots)
+                    FFT(complex) *first_stored = stored_fourier(
+                        fourier_map, dof_fourier, fourier_stride, h, i0, dof);
+                    FFT(complex) *last_stored =
+                        stored_fourier(fourier_map, dof_fourier, fourier_stride,
+                                       h, i0, dof + nseries - 1);
+                    bool direct =
+                        first_stored && last_stored &&
+                        (size_t)(last_stored - first_stored) ==
+                            (nseries - 1) * fourier_stride;
+                    FFT(complex) *fourier =
+                        direct ? first_stored : thread_fourier;
+                    FFT(execute_dft_r2c)(
+                        plan, &series[(dof - part_start) * nblocksteps],
+                        fourier);
 
-                // execute fftw
-                fftwf_execute(plan);
-
-                // save all fourier transforms
-                // index is
-                size_t dof_index =
-                    nfrequencies *
-                    (6 * moltype_firstmol[h] + 9 * moltype_firstatom[h] +
-                     6 * i0 + 9 * mol_natoms * i0 + dof);
-                memcpy(&dof_fourier[dof_index], fft_out,
-                       nfrequencies * sizeof(fftwf_complex));
-
-                // square and add to dos
-                for (unsigned long t = 0; t < nfrequencies; t++) {
-                    fft_out_squared[t] = cabs(fft_out[t] * fft_out[t]);
+                    // square and add to dos (thread private)
+                    for (size_t s = 0; s < nseries; s++) {
+                        accumulate_power_spectrum(
+                            nfrequencies, &fourier[s * fourier_stride],
+                            &thread_dos[dos_index + (s % 3) * nfrequencies]);
+                        FFT(complex) *stored =
+                            stored_fourier(fourier_map, dof_fourier,
+                                           fourier_stride, h, i0, dof + s);
+                        if (!direct && stored) {
+                            memcpy(stored, &fourier[s * fourier_stride],
+                                   nfrequencies * sizeof(FFT(complex)));
+                        }
+                    }
+                    dof += nseries;
                 }
+                part_start = part_end;
+            }
+        }
+
+        // sum thread private dos and add to output
+        thread_doses[omp_get_thread_num()] = thread_dos;
+        tree_reduce_thread_arrays(nmoltypes * ndos * nfrequencies,
+                                  thread_doses);
+#pragma omp master
+        for (size_t h = 0; h < nmoltypes; h++) {
+            for (size_t dos = 0; dos < ndos; dos++) {
                 size_t dos_index = h * ndos * nsamples * nfrequencies +
                                    dos * nsamples * nfrequencies +
                                    sample * nfrequencies;
-                cblas_saxpy(nfrequencies, 1.0, fft_out_squared, 1,
+                real *block_dos =
+                    &thread_dos[h * ndos * nfrequencies + dos * nfrequencies];
+                // squared deviations from the mean of the previous blocks
+                // for the standard error (optional), no cancellation like
+                // with sums of squares
+                if (moltypes_dos_m2_samples && block > 0) {
+                    for (unsigned long k = 0; k < nfrequencies; k++) {
+                        real delta = block_dos[k] -
+                                     moltypes_dos_samples[dos_index + k] /
+                                         (real)block;
+                        moltypes_dos_m2_samples[dos_index + k] +=
+                            delta * delta * (real)block / (real)(block + 1);
+                    }
+                }
+                CBLAS(axpy)(nfrequencies, 1.0, block_dos, 1,
                             &moltypes_dos_samples[dos_index], 1);
+                // spectra of this block alone (optional)
+                if (moltypes_dos_block) {
+                    memcpy(&moltypes_dos_block[(h * ndos + dos) *
+                                               nfrequencies],
+                           block_dos, nfrequencies * sizeof(real));
+                }
             }
         }
+#pragma omp barrier
+
+        free(thread_dos);
+        FFT(free)(thread_fourier);
+        FFT(free)(packed_re);
+        FFT(free)(packed_im);
     }
 
-    // fftwf_complex *dof_fourier = calloc(ndof*nfrequencies,
-    // sizeof(fftwf_complex));
-    for (size_t d = 0; d < ndof; d++) {
-        for (size_t t = 0; t < nfrequencies; t++) {
+    // cross spectra from the compiled plan
+    // pairs ("i", self terms of "e", neighbours of "n"): shared among the
+    // threads, each adds to its own spectra
+    // factors: every thread sums all molecules for its part of the
+    // frequencies
+    size_t ncross_spectra = cross_plan->ncross_spectra;
+#pragma omp parallel if (ncross_spectra > 0)
+    {
+        real *thread_cross_spectra =
+            calloc(ncross_spectra * nfrequencies, sizeof(real));
+        size_t nthreads = omp_get_num_threads();
+        size_t chunk = (nfrequencies + nthreads - 1) / nthreads;
+        size_t k0 = omp_get_thread_num() * chunk;
+        k0 = k0 < nfrequencies ? k0 : nfrequencies;
+        size_t nk = k0 + chunk < nfrequencies ? chunk : nfrequencies - k0;
+        real *chunk_work = calloc(2 * (chunk > 0 ? chunk : 1), sizeof(real));
+        FFT(complex) *chunk_fourier_sums =
+            calloc(2 * (chunk > 0 ? chunk : 1), sizeof(FFT(complex)));
+
+        for (size_t f = 0; f < cross_plan->nfactors; f++) {
+            cross_spectrum_factors *factors = &cross_plan->factors[f];
+            size_t d = factors->cross_spectrum;
+            accumulate_cross_spectrum_factors(
+                factors, cross_plan->correlations[d] == 'r', dof_fourier,
+                fourier_stride, k0, nk, chunk_work, chunk_fourier_sums,
+                &thread_cross_spectra[d * nfrequencies + k0]);
         }
-    }
 
-    for (size_t d = 0; d < ncross_spectra; d++) {
-        char cross_spectrum_type = cross_spectra_def[d].type;
-        size_t ncross_contribs = 0;
-        float *cross_spectrum = calloc(nfrequencies, sizeof(float));
-        for (size_t p = 0; p < cross_spectra_def[d].ndof_pair_defs; p++) {
-            // convenience
-            size_t moltypeA =
-                cross_spectra_def[d].dof_pair_defs[p].dofA_moltype;
-            size_t moltypeB =
-                cross_spectra_def[d].dof_pair_defs[p].dofB_moltype;
-            char typeA = cross_spectra_def[d].dof_pair_defs[p].dofA_type;
-            char typeB = cross_spectra_def[d].dof_pair_defs[p].dofB_type;
-
-            for (size_t dA = 0;
-                 dA < cross_spectra_def[d].dof_pair_defs[p].ndofA; dA++) {
-                for (size_t dB = 0;
-                     dB < cross_spectra_def[d].dof_pair_defs[p].ndofB; dB++) {
-                    // convenience
-                    size_t dofA =
-                        cross_spectra_def[d].dof_pair_defs[p].dofA_list[dA];
-                    size_t dofB =
-                        cross_spectra_def[d].dof_pair_defs[p].dofB_list[dB];
-                    if (cross_spectrum_type == 'e') {
-                        size_t nmolsA = moltype_nmols[moltypeA];
-                        size_t nmolsB = moltype_nmols[moltypeB];
-                        for (size_t iA = 0; iA < nmolsA; iA++) {
-                            for (size_t iB = 0; iB < nmolsB; iB++) {
-                                ncross_contribs++;
-                                // find index in
-                                size_t dof_fourier_indexA =
-                                    gen_dof_fourier_index(
-                                        nfrequencies, moltype_firstmol,
-                                        moltype_firstatom, moltype_natomspermol,
-                                        moltypeA, typeA, dofA, iA);
-                                size_t dof_fourier_indexB =
-                                    gen_dof_fourier_index(
-                                        nfrequencies, moltype_firstmol,
-                                        moltype_firstatom, moltype_natomspermol,
-                                        moltypeB, typeB, dofB, iB);
-
-                                for (unsigned long t = 0; t < nfrequencies;
-                                     t++) {
-                                    fft_out_squared[t] = cabs(
-                                        dof_fourier[dof_fourier_indexA + t] *
-                                        dof_fourier[dof_fourier_indexB + t]);
-                                }
-
-                                cblas_saxpy(nfrequencies, 1.0, fft_out_squared,
-                                            1, cross_spectrum, 1);
-                            }
-                        }
-                    } else if (cross_spectrum_type == 'i') {
-                        size_t nmolsA = moltype_nmols[moltypeA];
-                        for (size_t iA = 0; iA < nmolsA; iA++) {
-                            ncross_contribs++;
-                            // find index in
-                            size_t dof_fourier_indexA = gen_dof_fourier_index(
-                                nfrequencies, moltype_firstmol,
-                                moltype_firstatom, moltype_natomspermol,
-                                moltypeA, typeA, dofA, iA);
-                            size_t dof_fourier_indexB = gen_dof_fourier_index(
-                                nfrequencies, moltype_firstmol,
-                                moltype_firstatom, moltype_natomspermol,
-                                moltypeB, typeB, dofB, iA);
-
-                            for (unsigned long t = 0; t < nfrequencies; t++) {
-                                fft_out_squared[t] =
-                                    cabs(dof_fourier[dof_fourier_indexA + t] *
-                                         dof_fourier[dof_fourier_indexB + t]);
-                            }
+        // fixed pairs followed by the neighbour pairs of this block
+        size_t npairs = cross_plan->npairs + cross_plan->nneighbour_pairs;
+#pragma omp for schedule(static)
+        for (size_t n = 0; n < npairs; n++) {
+            cross_spectrum_pair *pair =
+                n < cross_plan->npairs
+                    ? &cross_plan->pairs[n]
+                    : &cross_plan->neighbour_pairs[n - cross_plan->npairs];
+            size_t d = pair->cross_spectrum;
+            FFT(complex) *fourierA =
+                &dof_fourier[pair->slotA * fourier_stride];
+            FFT(complex) *fourierB =
+                &dof_fourier[pair->slotB * fourier_stride];
+            if (cross_plan->correlations[d] == 'r') {
+                accumulate_real_cross_spectrum(
+                    nfrequencies, fourierA, fourierB, pair->weight,
+                    &thread_cross_spectra[d * nfrequencies]);
+            } else {
+                accumulate_cross_spectrum(
+                    nfrequencies, fourierA, fourierB, pair->weight,
+                    &thread_cross_spectra[d * nfrequencies]);
+            }
+        }
 
-                            cblas_saxpy(nfrequencies, 1.0, fft_out_squared, 1,
-                                        cross_spectrum, 1);
-                        }
-                    }
-                }
+        // sum thread private cross spectra, scale by 1/ncross_contribs and
+        // add to output
+        thread_doses[omp_get_thread_num()] = thread_cross_spectra;
+        tree_reduce_thread_arrays(ncross_spectra * nfrequencies,
+                                  thread_doses);
+#pragma omp master
+        for (size_t d = 0; d < ncross_spectra; d++) {
+            size_t cross_index =
+                d * nsamples * nfrequencies + sample * nfrequencies;
+            if (cross_plan->ncross_contribs[d] == 0) {
+                continue;
+            }
+            CBLAS(axpy)(nfrequencies,
+                        1.0 / (real)cross_plan->ncross_contribs[d],
+                        &thread_cross_spectra[d * nfrequencies], 1,
+                        &cross_spectra_samples[cross_index], 1);
+            if (cross_spectra_block) {
+                CBLAS(axpy)(nfrequencies,
+                            1.0 / (real)cross_plan->ncross_contribs[d],
+                            &thread_cross_spectra[d * nfrequencies], 1,
+                            &cross_spectra_block[d * nfrequencies], 1);
             }
         }
+#pragma omp barrier
 
-        // scale by 1/ncross_contribs and add to array
-        size_t cross_index =
-            d * nsamples * nfrequencies + sample * nfrequencies;
-        cblas_saxpy(nfrequencies, 1.0 / (float)ncross_contribs, cross_spectrum,
-                    1, &cross_spectra_samples[cross_index], 1);
-        free(cross_spectrum);
+        free(thread_cross_spectra);
+        free(chunk_work);
+        free(chunk_fourier_sums);
     }
 
-    fftwf_destroy_plan(plan);
-    free(fft_in);
-    fftwf_free(fft_out);
-    free(fft_out_squared);
-    free(dof_fourier);
+    free(thread_doses);
+    FFT(free)(dof_fourier);
 }
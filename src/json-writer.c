@@ -0,0 +1,319 @@
+#include "precision.h"
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef JSON_WRITER_DEF
+#define JSON_WRITER_DEF
+
+// nesting of objects and arrays the writer keeps track of
+#define JSON_MAX_DEPTH 16
+// stdio buffer of the output file
+#define JSON_BUFFER_SIZE (1 << 20)
+
+// digits that always survive a round trip of real -> decimal -> real
+// (REAL_DIG) and that are needed for every real (REAL_MAX_DIG)
+#ifdef DOUBLE_PRECISION
+#define REAL_DIG DBL_DIG
+#define REAL_MAX_DIG 17
+#define REAL_MANT_DIG DBL_MANT_DIG
+#define REAL_MIN DBL_MIN
+#define REAL_TRUE_MIN DBL_TRUE_MIN
+#define STRTOREAL strtod
+#else
+#define REAL_DIG FLT_DIG
+#define REAL_MAX_DIG 9
+#define REAL_MANT_DIG FLT_MANT_DIG
+#define REAL_MIN FLT_MIN
+#define REAL_TRUE_MIN FLT_TRUE_MIN
+#define STRTOREAL strtof
+#endif
+
+// the digits of a real are searched for in long double, which needs at
+// least 64 bits to be exact enough for double precision
+#if !defined(DOUBLE_PRECISION) || LDBL_MANT_DIG >= 64
+#define JSON_FAST_NUMBERS
+#endif
+
+// 10^k for JSON_POW10_MIN <= k < JSON_POW10_MIN + 16 * JSON_POW10_NLARGE
+#define JSON_POW10_MIN (-336)
+#define JSON_POW10_NLARGE 44
+long double json_pow10_small[20]; // exact in long double
+long double json_pow10_large[JSON_POW10_NLARGE];
+
+void init_json_pow10() {
+    json_pow10_small[0] = 1.0L;
+    for (int i = 1; i < 20; i++) {
+        json_pow10_small[i] = json_pow10_small[i - 1] * 10.0L;
+    }
+    for (int j = 0; j < JSON_POW10_NLARGE; j++) {
+        json_pow10_large[j] = powl(10.0L, JSON_POW10_MIN + 16 * j);
+    }
+}
+
+// within a few ulps of long double
+long double json_pow10(int k) {
+    return json_pow10_small[(k - JSON_POW10_MIN) % 16] *
+           json_pow10_large[(k - JSON_POW10_MIN) / 16];
+}
+
+// compact json written directly to a file, element by element, instead of
+// building the document in memory first
+typedef struct {
+    FILE *file;
+    char *buffer;
+    size_t depth;
+    bool empty[JSON_MAX_DEPTH]; // no element in the object/array yet
+} json_writer;
+
+// write to an open stream (e.g. from open_memstream), closed by json_close
+void json_open_stream(json_writer *writer, FILE *file) {
+    writer->file = file;
+    writer->buffer = NULL;
+    writer->depth = 0;
+    writer->empty[0] = true;
+    init_json_pow10();
+}
+
+// returns 1 if the file can not be opened
+int json_open(json_writer *writer, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+        return 1;
+    json_open_stream(writer, file);
+    writer->buffer = malloc(JSON_BUFFER_SIZE);
+    setvbuf(writer->file, writer->buffer, _IOFBF, JSON_BUFFER_SIZE);
+    return 0;
+}
+
+// returns 1 if anything could not be written
+int json_close(json_writer *writer) {
+    putc('\n', writer->file);
+    int result = ferror(writer->file) != 0;
+    result |= fclose(writer->file) != 0;
+    free(writer->buffer);
+    return result;
+}
+
+// quoted json string, with '"', '\\' and control characters escaped (names
+// of cross spectra are free text from the parameter file)
+void json_write_string(FILE *file, const char *string) {
+    putc('"', file);
+    for (const unsigned char *c = (const unsigned char *)string; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            putc('\\', file);
+            putc(*c, file);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            putc(*c, file);
+        }
+    }
+    putc('"', file);
+}
+
+// comma and key (NULL in arrays and at the top level) of the next element
+void json_key(json_writer *writer, const char *key) {
+    if (!writer->empty[writer->depth]) {
+        putc(',', writer->file);
+    }
+    writer->empty[writer->depth] = false;
+    if (key != NULL) {
+        json_write_string(writer->file, key);
+        putc(':', writer->file);
+    }
+}
+
+void json_begin(json_writer *writer, const char *key, char bracket) {
+    json_key(writer, key);
+    putc(bracket, writer->file);
+    if (writer->depth + 1 == JSON_MAX_DEPTH) {
+        fprintf(stderr, "ERROR: json nested too deeply.\n");
+        exit(1);
+    }
+    writer->depth++;
+    writer->empty[writer->depth] = true;
+}
+
+void json_end(json_writer *writer, char bracket) {
+    putc(bracket, writer->file);
+    writer->depth--;
+}
+
+void json_begin_object(json_writer *writer, const char *key) {
+    json_begin(writer, key, '{');
+}
+
+void json_end_object(json_writer *writer) { json_end(writer, '}'); }
+
+void json_begin_array(json_writer *writer, const char *key) {
+    json_begin(writer, key, '[');
+}
+
+void json_end_array(json_writer *writer) { json_end(writer, ']'); }
+
+void json_string(json_writer *writer, const char *key, const char *value) {
+    json_key(writer, key);
+    json_write_string(writer->file, value);
+}
+
+void json_integer(json_writer *writer, const char *key, unsigned long value) {
+    json_key(writer, key);
+    fprintf(writer->file, "%lu", value);
+}
+
+// the integer digits * 10^exponent as json number, like %g with
+// REAL_MAX_DIG digits: exponential notation only for very small or large
+// numbers, returns the number of characters
+int json_format_digits(unsigned long long digits, int exponent,
+                       char *string) {
+    while (digits % 10 == 0) {
+        digits /= 10;
+        exponent++;
+    }
+    char reversed[24];
+    int ndigits = 0;
+    for (; digits > 0; digits /= 10) {
+        reversed[ndigits++] = (char)('0' + digits % 10);
+    }
+    int first = exponent + ndigits - 1; // exponent of the first digit
+    int length = 0;
+    if (first < -4 || first >= REAL_MAX_DIG) {
+        string[length++] = reversed[ndigits - 1];
+        if (ndigits > 1) {
+            string[length++] = '.';
+        }
+        for (int i = ndigits - 2; i >= 0; i--) {
+            string[length++] = reversed[i];
+        }
+        length += sprintf(&string[length], "e%d", first);
+    } else if (first < 0) {
+        string[length++] = '0';
+        string[length++] = '.';
+        for (int i = first + 1; i < 0; i++) {
+            string[length++] = '0';
+        }
+        for (int i = ndigits - 1; i >= 0; i--) {
+            string[length++] = reversed[i];
+        }
+    } else {
+        for (int i = ndigits - 1; i >= 0; i--) {
+            string[length++] = reversed[i];
+            if (i == ndigits - 1 - first && i > 0) {
+                string[length++] = '.';
+            }
+        }
+        for (int i = ndigits; i <= first; i++) {
+            string[length++] = '0';
+        }
+    }
+    string[length] = '\0';
+    return length;
+}
+
+// shortest decimal that reads back as the same real (the closest one of
+// that length), null for nan and inf (like cJSON)
+// returns the number of characters written to string
+int json_format_number(real value, char *string) {
+    if (!isfinite(value)) {
+        return sprintf(string, "null");
+    }
+    if (value == 0.0) {
+        return sprintf(string, signbit(value) ? "-0" : "0");
+    }
+#ifdef JSON_FAST_NUMBERS
+    // every decimal strictly between lower and upper reads back as value,
+    // they are scaled to REAL_MAX_DIG digits before the decimal point
+    // candidates closer to the bounds than the rounding errors of long
+    // double (or on them, with ties to even) are checked with STRTOREAL
+    int sign = value < 0.0;
+    if (sign) {
+        string[0] = '-';
+    }
+    long double x = fabs((double)value);
+    int exponent2;
+    double mantissa = frexp((double)value, &exponent2);
+    // subnormals are REAL_TRUE_MIN apart, whatever their exponent
+    bool subnormal = x < REAL_MIN;
+    long double ulp = subnormal ? (long double)REAL_TRUE_MIN
+                                : ldexpl(1.0L, exponent2 - REAL_MANT_DIG);
+    bool narrow_below = fabs(mantissa) == 0.5 && !subnormal;
+    int exponent10 = (int)floor(log10((double)x));
+    long double scale = json_pow10(REAL_MAX_DIG - 1 - exponent10);
+    long double scaled = x * scale;
+    long double lower = (x - (narrow_below ? ulp / 4.0L : ulp / 2.0L)) * scale;
+    long double upper = (x + ulp / 2.0L) * scale;
+    long double margin = scaled * 1e-18L;
+
+    // bisect the number of digits n, the closest decimal of n digits (its
+    // trailing zeros are dropped) reads back for all n above the shortest
+    int shortest = 1;
+    int longest = REAL_MAX_DIG;
+    int found = 0;
+    unsigned long long found_digits = 0;
+    while (shortest <= longest) {
+        int n = (shortest + longest) / 2;
+        long double unit = json_pow10_small[REAL_MAX_DIG - n];
+        unsigned long long digits =
+            (unsigned long long)(scaled / unit + 0.5L);
+        long double candidate = digits * unit; // exact
+        long double distance = fminl(candidate - lower, upper - candidate);
+        bool reads_back = distance > margin;
+        if (!reads_back && distance > -margin && digits > 0) {
+            json_format_digits(digits, exponent10 - n + 1, &string[sign]);
+            reads_back = STRTOREAL(string, NULL) == value;
+        }
+        if (reads_back) {
+            found = n;
+            found_digits = digits;
+            longest = n - 1;
+        } else {
+            shortest = n + 1;
+        }
+    }
+    if (found > 0) {
+        return sign + json_format_digits(found_digits,
+                                         exponent10 - found + 1,
+                                         &string[sign]);
+    }
+#endif
+    // exact but slow, subnormals have fewer significant digits than REAL_DIG
+    int first_digits = fabs(value) < REAL_MIN ? 1 : REAL_DIG;
+    for (int digits = first_digits; digits <= REAL_MAX_DIG; digits++) {
+        snprintf(string, 32, "%.*g", digits, (double)value);
+        if (digits == REAL_MAX_DIG || STRTOREAL(string, NULL) == value)
+            break;
+    }
+    return (int)strlen(string);
+}
+
+void json_number(json_writer *writer, const char *key, real value) {
+    json_key(writer, key);
+    char string[32];
+    fwrite(string, 1, json_format_number(value, string), writer->file);
+}
+
+// array of n numbers
+void json_numbers(json_writer *writer, const char *key, unsigned long n,
+                  real *values) {
+    json_begin_array(writer, key);
+    for (unsigned long t = 0; t < n; t++) {
+        json_number(writer, NULL, values[t]);
+    }
+    json_end_array(writer);
+}
+
+// array of nsamples arrays of nvalues numbers each
+void json_samples(json_writer *writer, const char *key, size_t nsamples,
+                  unsigned long nvalues, real *values) {
+    json_begin_array(writer, key);
+    for (size_t sample = 0; sample < nsamples; sample++) {
+        json_numbers(writer, NULL, nvalues, &values[sample * nvalues]);
+    }
+    json_end_array(writer);
+}
+
+#endif
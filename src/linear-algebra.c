@@ -1,15 +1,20 @@
+#include "precision.h"
 #include <cblas.h>
 #include <lapacke.h>
-#include <math.h>
+#include <stddef.h>
+#include <tgmath.h>
 
-void crossProduct(float *x, float *y, float *c) {
+#ifndef LINEAR_ALGEBRA_DEF
+#define LINEAR_ALGEBRA_DEF
+
+void crossProduct(real *x, real *y, real *c) {
     c[0] = x[1] * y[2] - x[2] * y[1];
     c[1] = x[2] * y[0] - x[0] * y[2];
     c[2] = x[0] * y[1] - x[1] * y[0];
     return;
 }
 
-void crossProductInc(float *x, size_t incx, float *y, size_t incy, float *c,
+void crossProductInc(real *x, size_t incx, real *y, size_t incy, real *c,
                      size_t incc) {
     c[0 * incc] = x[1 * incx] * y[2 * incy] - x[2 * incx] * y[1 * incy];
     c[1 * incc] = x[2 * incx] * y[0 * incy] - x[0 * incx] * y[2 * incy];
@@ -17,8 +22,8 @@ void crossProductInc(float *x, size_t incx, float *y, size_t incy, float *c,
     return;
 }
 
-void moiTensorMixed(int mol_natoms, float *pos1, float *pos2, float *atom_mass,
-                    float *tensor) {
+void moiTensorMixed(int mol_natoms, real *pos1, real *pos2, real *atom_mass,
+                    real *tensor) {
     int a, b, j;
     for (a = 0; a < 9; a++)
         tensor[a] = 0.0;
@@ -38,40 +43,42 @@ void moiTensorMixed(int mol_natoms, float *pos1, float *pos2, float *atom_mass,
     }
 }
 
-void moiTensor(int mol_natoms, float *pos, float *atom_mass, float *tensor) {
+void moiTensor(int mol_natoms, real *pos, real *atom_mass, real *tensor) {
     moiTensorMixed(mol_natoms, pos, pos, atom_mass, tensor);
 }
 
 // invert square matrix
-lapack_int invert_matrix(float *A, unsigned n) {
+lapack_int invert_matrix(real *A, unsigned n) {
     int ipiv[n + 1];
     lapack_int ret;
-    ret = LAPACKE_sgetrf(LAPACK_ROW_MAJOR, n, n, A, n, ipiv);
+    ret = LAPACKE(getrf)(LAPACK_ROW_MAJOR, n, n, A, n, ipiv);
     if (ret != 0)
         return ret;
-    ret = LAPACKE_sgetri(LAPACK_ROW_MAJOR, n, A, n, ipiv);
+    ret = LAPACKE(getri)(LAPACK_ROW_MAJOR, n, A, n, ipiv);
     return ret;
 }
 
 // squareroot of matrix
-lapack_int squareroot_of_matrix(float *A, unsigned N) {
+lapack_int squareroot_of_matrix(real *A, unsigned N) {
     lapack_int ret;
     // eigenvectors
-    float eigenvalues[N];
-    ret = LAPACKE_ssyev(LAPACK_ROW_MAJOR, 'V', 'U', N, A, N, eigenvalues);
+    real eigenvalues[N];
+    ret = LAPACKE(syev)(LAPACK_ROW_MAJOR, 'V', 'U', N, A, N, eigenvalues);
     if (ret != 0)
         return ret;
     // calculate B = eigenvectors @ diag(sqrt(eigenvalues))
-    float B[N * N];
+    real B[N * N];
     for (unsigned a = 0; a < N; a++) {
         for (unsigned b = 0; b < N; b++) {
             B[a * N + b] = A[a * N + b] * sqrt(eigenvalues[b]);
         }
     }
     // calculate C = B @ eigv(A).T
-    float C[N * N];
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, N, N, N, 1.0, B, N, A,
+    real C[N * N];
+    CBLAS(gemm)(CblasRowMajor, CblasNoTrans, CblasTrans, N, N, N, 1.0, B, N, A,
                 N, 0.0, C, N);
-    cblas_scopy(N * N, C, 1, A, 1);
+    CBLAS(copy)(N * N, C, 1, A, 1);
     return ret;
 }
+
+#endif
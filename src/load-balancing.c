@@ -0,0 +1,203 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef LOAD_BALANCING_DEF
+#define LOAD_BALANCING_DEF
+
+// relative cost of the velocity decomposition of one molecule
+// per atom work grows with the rotational treatment, LAPACK calls and the
+// like are a constant per molecule
+float moltype_decomposition_cost(size_t natomspermol, char rot_treat) {
+    if (natomspermol == 1) {
+        return 1.0;
+    }
+    float atom_cost;
+    float mol_cost;
+    if (rot_treat == 'u') {
+        atom_cost = 1.0;
+        mol_cost = 1.0;
+    } else if (rot_treat == 'l') {
+        atom_cost = 4.0;
+        mol_cost = 20.0;
+    } else if (rot_treat == 'f' || rot_treat == 'a') {
+        atom_cost = 5.0;
+        mol_cost = 40.0;
+    } else {
+        // Eckart frame: additional F, c_alpha, J' and vibc per atom
+        atom_cost = 12.0;
+        mol_cost = 80.0;
+    }
+    return mol_cost + atom_cost * (float)natomspermol;
+}
+
+// parts of the dof of a molecule (trn, rot_xyz, vib, rot_omega, vibc) that
+// decompose_velocities leaves zero for its rotational treatment
+// by linearity of the DFT their transforms are zero as well
+void moltype_zero_dof_parts(size_t natomspermol, char rot_treat,
+                            bool *zero_parts) { // output
+    bool single_atom = natomspermol == 1;
+    bool unseparated = rot_treat == 'u';
+    bool eckart = rot_treat == 'e' || rot_treat == 'p' || rot_treat == 'E' ||
+                  rot_treat == 'P';
+    zero_parts[0] = !single_atom && unseparated;
+    zero_parts[1] = single_atom || unseparated;
+    zero_parts[2] = single_atom;
+    zero_parts[3] = single_atom || unseparated;
+    zero_parts[4] = single_atom || !eckart;
+}
+
+// relative cost of the fourier transforms of one molecule (number of dof
+// that are not zero)
+float moltype_fft_cost(size_t natomspermol, char rot_treat) {
+    bool zero_parts[5];
+    moltype_zero_dof_parts(natomspermol, rot_treat, zero_parts);
+    float part_ndof[5] = {3.0, 3.0 * (float)natomspermol,
+                          3.0 * (float)natomspermol, 3.0,
+                          3.0 * (float)natomspermol};
+    float cost = 0.0;
+    for (size_t part = 0; part < 5; part++) {
+        if (!zero_parts[part]) {
+            cost += part_ndof[part];
+        }
+    }
+    return cost;
+}
+
+typedef struct {
+    float cost;
+    size_t mol;
+} mol_cost_pair;
+
+int compare_mol_cost_pairs(const void *a, const void *b) {
+    const mol_cost_pair *pa = a;
+    const mol_cost_pair *pb = b;
+    // descending cost, ascending molecule index for equal cost
+    if (pa->cost > pb->cost)
+        return -1;
+    if (pa->cost < pb->cost)
+        return 1;
+    return (pa->mol > pb->mol) - (pa->mol < pb->mol);
+}
+
+// order molecules by descending cost (longest processing time first)
+// with dynamic scheduling expensive molecules are started first and the
+// cheap ones fill up the threads in the end
+// returns whether the cost is heterogeneous enough for dynamic scheduling
+bool calc_mols_schedule(size_t nmols, size_t *mols_moltypenr,
+                        float *moltypes_cost,
+                        size_t *mols_order) { // output
+    float min_cost = 0.0;
+    float max_cost = 0.0;
+    for (size_t i = 0; i < nmols; i++) {
+        float cost = moltypes_cost[mols_moltypenr[i]];
+        if (i == 0 || cost < min_cost)
+            min_cost = cost;
+        if (i == 0 || cost > max_cost)
+            max_cost = cost;
+        mols_order[i] = i;
+    }
+    // keep trajectory order for (roughly) homogeneous systems
+    if (max_cost <= 2.0 * min_cost) {
+        return false;
+    }
+    mol_cost_pair *pairs = malloc(nmols * sizeof(mol_cost_pair));
+    for (size_t i = 0; i < nmols; i++) {
+        pairs[i].cost = moltypes_cost[mols_moltypenr[i]];
+        pairs[i].mol = i;
+    }
+    qsort(pairs, nmols, sizeof(mol_cost_pair), compare_mol_cost_pairs);
+    for (size_t k = 0; k < nmols; k++) {
+        mols_order[k] = pairs[k].mol;
+    }
+    free(pairs);
+    return true;
+}
+
+// a contiguous range of dof of one molecule to be fourier transformed
+// pair_next: also transform the same dof of the next molecule
+// (fft_packing 'm')
+typedef struct {
+    size_t mol;
+    size_t first_dof;
+    size_t last_dof;
+    bool pair_next;
+} fft_work_item;
+
+// split the fourier transforms into work items following mols_order
+// molecules with more dof than a fraction of a thread's fair share (e.g.
+// few polymer chains) are split into several items, so that their
+// transforms are spread over all threads
+// items always start at an x component (multiple of 3 dof)
+// with pair_mols the items of every other molecule of a moltype also
+// transform the next one, which gets no items itself
+// mols_order may leave out molecules (see filter_mols_order), a molecule
+// is then only paired with a next one that is scheduled as well
+size_t calc_fft_work_items(size_t nmols, size_t *mols_order,
+                           size_t *mols_moltypenr, size_t *moltypes_firstmol,
+                           size_t *moltypes_natomspermol, bool pair_mols,
+                           size_t nthreads,
+                           fft_work_item **fft_work_items) { // output
+    size_t ndof = 0;
+    size_t nmols_all = 0;
+    for (size_t k = 0; k < nmols; k++) {
+        size_t i = mols_order[k];
+        ndof += 6 + 9 * moltypes_natomspermol[mols_moltypenr[i]];
+        nmols_all = i + 1 > nmols_all ? i + 1 : nmols_all;
+    }
+    size_t max_item_ndof = ndof / (4 * nthreads) / 3 * 3;
+    if (max_item_ndof < 63) {
+        max_item_ndof = 63;
+    }
+
+    // molecules that are transformed with the previous one
+    bool *scheduled = calloc(nmols_all + 1, sizeof(bool));
+    for (size_t k = 0; k < nmols; k++) {
+        scheduled[mols_order[k]] = true;
+    }
+    bool *paired = calloc(nmols_all + 1, sizeof(bool));
+    for (size_t k = 0; k < nmols && pair_mols; k++) {
+        size_t i = mols_order[k];
+        size_t h = mols_moltypenr[i];
+        if ((i - moltypes_firstmol[h]) % 2 == 0 && scheduled[i + 1] &&
+            mols_moltypenr[i + 1] == h) {
+            paired[i + 1] = true;
+        }
+    }
+
+    // count items
+    size_t nitems = 0;
+    for (size_t k = 0; k < nmols; k++) {
+        size_t i = mols_order[k];
+        if (paired[i]) {
+            continue;
+        }
+        size_t mol_ndof = 6 + 9 * moltypes_natomspermol[mols_moltypenr[i]];
+        nitems += (mol_ndof + max_item_ndof - 1) / max_item_ndof;
+    }
+
+    // fill items
+    *fft_work_items = malloc(nitems * sizeof(fft_work_item));
+    size_t item = 0;
+    for (size_t k = 0; k < nmols; k++) {
+        size_t i = mols_order[k];
+        if (paired[i]) {
+            continue;
+        }
+        size_t mol_ndof = 6 + 9 * moltypes_natomspermol[mols_moltypenr[i]];
+        for (size_t dof = 0; dof < mol_ndof; dof += max_item_ndof) {
+            (*fft_work_items)[item].mol = i;
+            (*fft_work_items)[item].first_dof = dof;
+            (*fft_work_items)[item].last_dof =
+                dof + max_item_ndof < mol_ndof ? dof + max_item_ndof
+                                               : mol_ndof;
+            (*fft_work_items)[item].pair_next = paired[i + 1];
+            item++;
+        }
+    }
+    free(scheduled);
+    free(paired);
+    return nitems;
+}
+
+#endif
@@ -0,0 +1,255 @@
+#include "precision.h"
+#include "velocity-decomposition.c"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tgmath.h>
+
+#ifndef NEIGHBOUR_LIST_DEF
+#define NEIGHBOUR_LIST_DEF
+
+// center of mass of the molecules firstmol to firstmol + nmols (all of one
+// moltype) in one frame, recombined over the periodic boundaries
+void calc_mols_com(real *pos, real *box, real *box_inv, bool no_pbc,
+                   size_t firstmol, size_t nmols, size_t *mols_firstatom,
+                   size_t natomspermol, real *atommasses, real *mols_mass,
+                   real *mols_com) { // output
+    real *positions = calloc(3 * natomspermol, sizeof(real));
+    for (size_t i = 0; i < nmols; i++) {
+        size_t m_firstatom = mols_firstatom[firstmol + i];
+        for (size_t j = 0; j < 3 * natomspermol; j++) {
+            positions[j] = pos[3 * m_firstatom + j];
+        }
+        if (no_pbc == false) {
+            recombine_molecule(box, box_inv, natomspermol, positions);
+        }
+        for (size_t dim = 0; dim < 3; dim++) {
+            mols_com[3 * i + dim] = CBLAS(dot)(natomspermol, atommasses, 1,
+                                               &positions[0 + dim], 3);
+            mols_com[3 * i + dim] /= mols_mass[firstmol + i];
+        }
+    }
+    free(positions);
+}
+
+// width of the cell perpendicular to the face spanned by the other two cell
+// vectors, for every cell vector k (columns of box)
+void calc_box_widths(real *box, real *widths) { // output
+    real volume = 0.0;
+    real normals[9];
+    for (size_t k = 0; k < 3; k++) {
+        size_t l = (k + 1) % 3;
+        size_t m = (k + 2) % 3;
+        for (size_t dim = 0; dim < 3; dim++) {
+            size_t dim1 = (dim + 1) % 3;
+            size_t dim2 = (dim + 2) % 3;
+            normals[3 * k + dim] = box[3 * dim1 + l] * box[3 * dim2 + m] -
+                                   box[3 * dim2 + l] * box[3 * dim1 + m];
+        }
+    }
+    for (size_t dim = 0; dim < 3; dim++) {
+        volume += box[3 * dim + 0] * normals[3 * 0 + dim];
+    }
+    for (size_t k = 0; k < 3; k++) {
+        real area = sqrt(normals[3 * k + 0] * normals[3 * k + 0] +
+                         normals[3 * k + 1] * normals[3 * k + 1] +
+                         normals[3 * k + 2] * normals[3 * k + 2]);
+        widths[k] = fabs(volume) / area;
+    }
+}
+
+// all pairs (iA, iB) of points A and B closer than cutoff, as 2 * npairs
+// indices in *pairs (room for *capacity pairs, reallocated if needed, so it
+// can be reused for the next call), returns npairs
+// the points are sorted into a cell list, so every point is only compared
+// with the points in the 27 surrounding cells
+// periodic: cells and minimum image from box, the cutoff may be at most half
+// the box width
+// not periodic: cells span the bounding box of the points
+size_t calc_neighbour_pairs(size_t nA, real *pointsA, size_t nB,
+                            real *pointsB, real *box, bool periodic,
+                            real cutoff, bool exclude_same_index,
+                            size_t **pairs, size_t *capacity) { // output
+    // fractional coordinates: periodic within the box, otherwise within the
+    // bounding box
+    real box_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    real lower[3] = {0.0, 0.0, 0.0};
+    real extent[3] = {0.0, 0.0, 0.0};
+    size_t ncells[3];
+    if (periodic) {
+        invert_box(box, box_inv);
+        real widths[3];
+        calc_box_widths(box, widths);
+        for (size_t k = 0; k < 3; k++) {
+            if (2 * cutoff > widths[k]) {
+                fprintf(stderr,
+                        "ERROR: cross spectrum cutoff %f is larger than half "
+                        "the box width %f.\n",
+                        cutoff, widths[k]);
+                exit(1);
+            }
+            ncells[k] = (size_t)(widths[k] / cutoff);
+        }
+    } else {
+        for (size_t dim = 0; dim < 3; dim++) {
+            real upper = -INFINITY;
+            lower[dim] = INFINITY;
+            for (size_t i = 0; i < nA; i++) {
+                lower[dim] = fmin(lower[dim], pointsA[3 * i + dim]);
+                upper = fmax(upper, pointsA[3 * i + dim]);
+            }
+            for (size_t i = 0; i < nB; i++) {
+                lower[dim] = fmin(lower[dim], pointsB[3 * i + dim]);
+                upper = fmax(upper, pointsB[3 * i + dim]);
+            }
+            extent[dim] = upper > lower[dim] ? upper - lower[dim] : 0.0;
+            ncells[dim] = (size_t)(extent[dim] / cutoff);
+            ncells[dim] = ncells[dim] > 0 ? ncells[dim] : 1;
+        }
+    }
+    // cells may be wider than the cutoff: at most about one point of B per
+    // cell, otherwise sparse systems with a small cutoff (no pbc, large
+    // boxes) would need a huge, mostly empty cell list
+    size_t max_ncells = (size_t)cbrt((double)nB) + 1;
+    for (size_t k = 0; k < 3; k++) {
+        ncells[k] = ncells[k] < max_ncells ? ncells[k] : max_ncells;
+    }
+    size_t ncells_total = ncells[0] * ncells[1] * ncells[2];
+
+    // fractional coordinates of B and cell index
+    real *fractionalB = malloc(3 * nB * sizeof(real));
+    size_t *cellB = malloc(nB * sizeof(size_t));
+    real *fractionalA = malloc(3 * nA * sizeof(real));
+    size_t *cellA = malloc(nA * sizeof(size_t));
+    for (size_t ab = 0; ab < 2; ab++) {
+        size_t n = ab == 0 ? nA : nB;
+        real *points = ab == 0 ? pointsA : pointsB;
+        real *fractional = ab == 0 ? fractionalA : fractionalB;
+        size_t *cell = ab == 0 ? cellA : cellB;
+        for (size_t i = 0; i < n; i++) {
+            size_t c[3];
+            for (size_t k = 0; k < 3; k++) {
+                real s;
+                if (periodic) {
+                    s = box_inv[3 * k + 0] * points[3 * i + 0] +
+                        box_inv[3 * k + 1] * points[3 * i + 1] +
+                        box_inv[3 * k + 2] * points[3 * i + 2];
+                    s -= floor(s);
+                } else if (extent[k] > 0.0) {
+                    s = (points[3 * i + k] - lower[k]) / extent[k];
+                } else {
+                    s = 0.0;
+                }
+                fractional[3 * i + k] = s;
+                c[k] = (size_t)(s * ncells[k]);
+                c[k] = c[k] < ncells[k] ? c[k] : ncells[k] - 1;
+            }
+            cell[i] = (c[0] * ncells[1] + c[1]) * ncells[2] + c[2];
+        }
+    }
+
+    // sort B into cells (counting sort)
+    size_t *cell_start = calloc(ncells_total + 1, sizeof(size_t));
+    size_t *cell_members = malloc(nB * sizeof(size_t));
+    for (size_t i = 0; i < nB; i++) {
+        cell_start[cellB[i] + 1]++;
+    }
+    for (size_t c = 0; c < ncells_total; c++) {
+        cell_start[c + 1] += cell_start[c];
+    }
+    size_t *cell_fill = malloc(ncells_total * sizeof(size_t));
+    for (size_t c = 0; c < ncells_total; c++) {
+        cell_fill[c] = cell_start[c];
+    }
+    for (size_t i = 0; i < nB; i++) {
+        cell_members[cell_fill[cellB[i]]++] = i;
+    }
+    free(cell_fill);
+
+    // neighbouring cells of every A
+    // with one or two periodic cells per direction, -1 and +1 would visit a
+    // cell twice
+    size_t npairs = 0;
+    real cutoff2 = cutoff * cutoff;
+    for (size_t iA = 0; iA < nA; iA++) {
+        size_t c[3];
+        c[2] = cellA[iA] % ncells[2];
+        c[1] = cellA[iA] / ncells[2] % ncells[1];
+        c[0] = cellA[iA] / ncells[2] / ncells[1];
+        long first[3], last[3];
+        for (size_t k = 0; k < 3; k++) {
+            first[k] = periodic && ncells[k] <= 2 ? 0 : -1;
+            last[k] = periodic && ncells[k] == 1 ? 0 : 1;
+        }
+        for (long o0 = first[0]; o0 <= last[0]; o0++) {
+            for (long o1 = first[1]; o1 <= last[1]; o1++) {
+                for (long o2 = first[2]; o2 <= last[2]; o2++) {
+                    long offset[3] = {o0, o1, o2};
+                    long n[3];
+                    bool outside = false;
+                    for (size_t k = 0; k < 3; k++) {
+                        n[k] = (long)c[k] + offset[k];
+                        if (periodic) {
+                            n[k] = (n[k] + (long)ncells[k]) % (long)ncells[k];
+                        } else if (n[k] < 0 || n[k] >= (long)ncells[k]) {
+                            outside = true;
+                        }
+                    }
+                    if (outside) {
+                        continue;
+                    }
+                    size_t cell = (n[0] * ncells[1] + n[1]) * ncells[2] + n[2];
+                    for (size_t m = cell_start[cell]; m < cell_start[cell + 1];
+                         m++) {
+                        size_t iB = cell_members[m];
+                        if (exclude_same_index && iA == iB) {
+                            continue;
+                        }
+                        real distance2 = 0.0;
+                        if (periodic) {
+                            real ds[3];
+                            for (size_t k = 0; k < 3; k++) {
+                                ds[k] = fractionalB[3 * iB + k] -
+                                        fractionalA[3 * iA + k];
+                                ds[k] -= rint(ds[k]);
+                            }
+                            for (size_t dim = 0; dim < 3; dim++) {
+                                real dr = box[3 * dim + 0] * ds[0] +
+                                          box[3 * dim + 1] * ds[1] +
+                                          box[3 * dim + 2] * ds[2];
+                                distance2 += dr * dr;
+                            }
+                        } else {
+                            for (size_t dim = 0; dim < 3; dim++) {
+                                real dr = pointsB[3 * iB + dim] -
+                                          pointsA[3 * iA + dim];
+                                distance2 += dr * dr;
+                            }
+                        }
+                        if (distance2 >= cutoff2) {
+                            continue;
+                        }
+                        if (npairs == *capacity) {
+                            *capacity = *capacity > 0 ? 2 * *capacity : 1024;
+                            *pairs = realloc(*pairs,
+                                             2 * *capacity * sizeof(size_t));
+                        }
+                        (*pairs)[2 * npairs + 0] = iA;
+                        (*pairs)[2 * npairs + 1] = iB;
+                        npairs++;
+                    }
+                }
+            }
+        }
+    }
+
+    free(fractionalA);
+    free(fractionalB);
+    free(cellA);
+    free(cellB);
+    free(cell_start);
+    free(cell_members);
+    return npairs;
+}
+
+#endif
@@ -1,9 +1,11 @@
 #include "cjson/cJSON.h"
+#include "precision.h"
 #include "structs.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <tgmath.h>
 
 int read_file(const char *filename, char **content) {
     long length = 0;
@@ -79,7 +81,7 @@ int json_parse_int(cJSON *json, char *key) {
     return json_number->valueint;
 }
 
-int json_parse_float(cJSON *json, char *key) {
+real json_parse_float(cJSON *json, char *key) {
     const cJSON *json_number = NULL;
     json_number = cJSON_GetObjectItemCaseSensitive(json, key);
     if (!cJSON_IsNumber(json_number)) {
@@ -87,7 +89,7 @@ int json_parse_float(cJSON *json, char *key) {
         cJSON_Delete(json);
         exit(1);
     }
-    return (float)json_number->valuedouble;
+    return (real)json_number->valuedouble;
 }
 
 char json_parse_char(cJSON *json, char *key) {
@@ -122,7 +124,7 @@ char *json_parse_string(cJSON *json, char *key) {
     return json_string->valuestring;
 }
 
-float json_parse_float_nokey(cJSON *json_number) {
+real json_parse_float_nokey(cJSON *json_number) {
     if (!cJSON_IsNumber(json_number)) {
         fprintf(stderr, "ERROR: float could not be parsed.");
         cJSON_Delete(json_number);
@@ -149,12 +151,37 @@ void json_parse_json_array(cJSON *json, char *key, cJSON **array) {
     }
 }
 
+// a number or an array of numbers, returns the number of values (1 for a
+// number), *values is allocated
+size_t json_parse_int_list(cJSON *json, char *key, int **values) {
+    cJSON *json_values = cJSON_GetObjectItemCaseSensitive(json, key);
+    if (cJSON_IsNumber(json_values)) {
+        *values = malloc(sizeof(int));
+        (*values)[0] = json_values->valueint;
+        return 1;
+    }
+    json_parse_json_array(json, key, &json_values);
+    size_t nvalues = cJSON_GetArraySize(json_values);
+    if (nvalues == 0) {
+        fprintf(stderr, "ERROR: '%s' array is empty.\n", key);
+        exit(1);
+    }
+    *values = malloc(nvalues * sizeof(int));
+    for (size_t v = 0; v < nvalues; v++) {
+        (*values)[v] = json_parse_int_nokey(cJSON_GetArrayItem(json_values, v));
+    }
+    return nvalues;
+}
+
 int parse_dosparams(const char *dosparams_file,
-                    size_t *nsamples, // output
-                    size_t *nblocks, unsigned long *nblocksteps,
-                    size_t *nmoltypes, size_t **moltypes_nmols,
+                    size_t *nresolutions, // output
+                    size_t **nsamples, size_t **nblocks,
+                    unsigned long **nblocksteps,
+                    real *max_frequency, real *block_overlap, char *window,
+                    unsigned long *subsample_seed, size_t *nmoltypes,
+                    size_t **moltypes_nmols, size_t **moltypes_nselected,
                     size_t **moltypes_natomspermol,
-                    float ***moltypes_atommasses, char **moltypes_rot_treat,
+                    real ***moltypes_atommasses, char **moltypes_rot_treat,
                     int ***moltypes_abc_indicators, size_t *ncross_spectra,
                     cross_spectrum_def **cross_spectra_def) {
     // tokenize file
@@ -162,9 +189,78 @@ int parse_dosparams(const char *dosparams_file,
     json_parse_file(dosparams_file, &dosparams_json);
 
     // parse numbers
-    *nsamples = (size_t)json_parse_int(dosparams_json, "nsamples");
-    *nblocks = (size_t)json_parse_int(dosparams_json, "nblocks");
-    *nblocksteps = (size_t)json_parse_int(dosparams_json, "nblocksteps");
+    // nblocksteps can be a list of block lengths (resolutions), which are
+    // all calculated in one pass, nsamples and nblocks are then either lists
+    // of the same length or the same for all
+    int *values;
+    *nresolutions = json_parse_int_list(dosparams_json, "nblocksteps", &values);
+    *nblocksteps = malloc(*nresolutions * sizeof(unsigned long));
+    for (size_t r = 0; r < *nresolutions; r++) {
+        (*nblocksteps)[r] = (unsigned long)values[r];
+    }
+    free(values);
+    char *partition_keys[2] = {"nsamples", "nblocks"};
+    size_t **partitions[2] = {nsamples, nblocks};
+    for (size_t k = 0; k < 2; k++) {
+        size_t nvalues =
+            json_parse_int_list(dosparams_json, partition_keys[k], &values);
+        if (nvalues != 1 && nvalues != *nresolutions) {
+            fprintf(stderr,
+                    "ERROR: %s has to be a number or a list as long as "
+                    "nblocksteps.\n",
+                    partition_keys[k]);
+            exit(1);
+        }
+        *partitions[k] = malloc(*nresolutions * sizeof(size_t));
+        for (size_t r = 0; r < *nresolutions; r++) {
+            (*partitions[k])[r] = (size_t)values[nvalues == 1 ? 0 : r];
+        }
+        free(values);
+    }
+
+    // max_frequency (optional), 0 keeps all frequencies
+    *max_frequency = 0.0;
+    if (cJSON_GetObjectItemCaseSensitive(dosparams_json, "max_frequency")) {
+        *max_frequency = json_parse_float(dosparams_json, "max_frequency");
+        if (*max_frequency <= 0.0) {
+            fprintf(stderr, "ERROR: max_frequency has to be positive.\n");
+            exit(1);
+        }
+    }
+
+    // block_overlap (optional), fraction of nblocksteps shared by
+    // consecutive blocks of a sample
+    *block_overlap = 0.0;
+    if (cJSON_GetObjectItemCaseSensitive(dosparams_json, "block_overlap")) {
+        *block_overlap = json_parse_float(dosparams_json, "block_overlap");
+        if (*block_overlap < 0.0 || *block_overlap >= 1.0) {
+            fprintf(stderr, "ERROR: block_overlap has to be at least 0 and "
+                            "less than 1.\n");
+            exit(1);
+        }
+    }
+
+    // window (optional), applied to every block before the FFT
+    *window = 'r';
+    if (cJSON_GetObjectItemCaseSensitive(dosparams_json, "window")) {
+        char *window_name = json_parse_string(dosparams_json, "window");
+        if (strcmp(window_name, "hann") == 0) {
+            *window = 'h';
+        } else if (strcmp(window_name, "blackman") == 0) {
+            *window = 'b';
+        } else if (strcmp(window_name, "rectangular") != 0) {
+            fprintf(stderr, "ERROR: window has to be 'rectangular', 'hann' "
+                            "or 'blackman'.\n");
+            exit(1);
+        }
+    }
+
+    // subsample_seed (optional), seed of the random molecule subsets
+    *subsample_seed = 1;
+    if (cJSON_GetObjectItemCaseSensitive(dosparams_json, "subsample_seed")) {
+        *subsample_seed = (unsigned long)json_parse_int(dosparams_json,
+                                                        "subsample_seed");
+    }
 
     // parse moltypes array
     cJSON *moltypes_json = NULL;
@@ -173,8 +269,9 @@ int parse_dosparams(const char *dosparams_file,
 
     // allocate moltypes arrays
     *moltypes_nmols = calloc(*nmoltypes, sizeof(size_t));
+    *moltypes_nselected = calloc(*nmoltypes, sizeof(size_t));
     *moltypes_natomspermol = calloc(*nmoltypes, sizeof(size_t));
-    *moltypes_atommasses = (float **)malloc(*nmoltypes * sizeof(float *));
+    *moltypes_atommasses = (real **)malloc(*nmoltypes * sizeof(real *));
     *moltypes_rot_treat = calloc(*nmoltypes, sizeof(char));
     *moltypes_abc_indicators = (int **)malloc(*nmoltypes * sizeof(int *));
 
@@ -185,12 +282,40 @@ int parse_dosparams(const char *dosparams_file,
         moltype_json = cJSON_GetArrayItem(moltypes_json, h);
         // nmols
         (*moltypes_nmols)[h] = (size_t)json_parse_int(moltype_json, "nmols");
+        // sample_fraction and max_mols (optional), only a random subset of
+        // the molecules is processed, the smaller of both if both are given
+        (*moltypes_nselected)[h] = (*moltypes_nmols)[h];
+        if (cJSON_GetObjectItemCaseSensitive(moltype_json,
+                                             "sample_fraction")) {
+            real sample_fraction =
+                json_parse_float(moltype_json, "sample_fraction");
+            if (sample_fraction <= 0.0 || sample_fraction > 1.0) {
+                fprintf(stderr, "ERROR: sample_fraction has to be larger "
+                                "than 0 and at most 1.\n");
+                exit(1);
+            }
+            (*moltypes_nselected)[h] =
+                (size_t)round(sample_fraction * (*moltypes_nmols)[h]);
+            if ((*moltypes_nselected)[h] == 0 && (*moltypes_nmols)[h] > 0) {
+                (*moltypes_nselected)[h] = 1;
+            }
+        }
+        if (cJSON_GetObjectItemCaseSensitive(moltype_json, "max_mols")) {
+            int max_mols = json_parse_int(moltype_json, "max_mols");
+            if (max_mols < 1) {
+                fprintf(stderr, "ERROR: max_mols has to be positive.\n");
+                exit(1);
+            }
+            if ((size_t)max_mols < (*moltypes_nselected)[h]) {
+                (*moltypes_nselected)[h] = (size_t)max_mols;
+            }
+        }
         // atommasses
         cJSON *atommasses_json = NULL;
         json_parse_json_array(moltype_json, "atom_masses", &atommasses_json);
         (*moltypes_natomspermol)[h] = cJSON_GetArraySize(atommasses_json);
         (*moltypes_atommasses)[h] =
-            (float *)malloc((*moltypes_natomspermol)[h] * sizeof(float));
+            (real *)malloc((*moltypes_natomspermol)[h] * sizeof(real));
         for (size_t j = 0; j < (*moltypes_natomspermol)[h]; j++) {
             cJSON *atommass = cJSON_GetArrayItem(atommasses_json, j);
             (*moltypes_atommasses)[h][j] = json_parse_float_nokey(atommass);
@@ -234,6 +359,55 @@ int parse_dosparams(const char *dosparams_file,
                json_parse_string(cross_spectrum, "name"));
         // type
         (*cross_spectra_def)[d].type = json_parse_char(cross_spectrum, "type");
+        if ((*cross_spectra_def)[d].type != 'i' &&
+            (*cross_spectra_def)[d].type != 'e' &&
+            (*cross_spectra_def)[d].type != 'n') {
+            fprintf(stderr,
+                    "ERROR: cross_spectrum type has to be 'i', 'e' or 'n'.\n");
+            exit(1);
+        }
+        // cutoff (only and required for type 'n')
+        (*cross_spectra_def)[d].cutoff = 0.0;
+        if ((*cross_spectra_def)[d].type == 'n') {
+            (*cross_spectra_def)[d].cutoff =
+                json_parse_float(cross_spectrum, "cutoff");
+            if ((*cross_spectra_def)[d].cutoff <= 0.0) {
+                fprintf(stderr, "ERROR: cutoff has to be positive.\n");
+                exit(1);
+            }
+        } else if (cJSON_GetObjectItemCaseSensitive(cross_spectrum,
+                                                    "cutoff")) {
+            fprintf(stderr, "ERROR: cutoff is only possible for "
+                            "cross_spectrum type 'n'.\n");
+            exit(1);
+        }
+        // exclude_self (optional)
+        cJSON *exclude_self =
+            cJSON_GetObjectItemCaseSensitive(cross_spectrum, "exclude_self");
+        if (exclude_self && !cJSON_IsBool(exclude_self)) {
+            fprintf(stderr, "ERROR: exclude_self could not be parsed.\n");
+            exit(1);
+        }
+        (*cross_spectra_def)[d].exclude_self = cJSON_IsTrue(exclude_self);
+        if ((*cross_spectra_def)[d].exclude_self &&
+            (*cross_spectra_def)[d].type == 'i') {
+            fprintf(stderr, "ERROR: exclude_self is only possible for "
+                            "cross_spectrum type 'e' and 'n'.\n");
+            exit(1);
+        }
+        // correlation (optional)
+        (*cross_spectra_def)[d].correlation = 'a';
+        if (cJSON_GetObjectItemCaseSensitive(cross_spectrum, "correlation")) {
+            char *correlation =
+                json_parse_string(cross_spectrum, "correlation");
+            if (strcmp(correlation, "real") == 0) {
+                (*cross_spectra_def)[d].correlation = 'r';
+            } else if (strcmp(correlation, "abs") != 0) {
+                fprintf(stderr,
+                        "ERROR: correlation has to be 'abs' or 'real'.\n");
+                exit(1);
+            }
+        }
         // dof_pairs
         cJSON *dof_pairs = NULL;
         json_parse_json_array(cross_spectrum, "dof_pairs", &dof_pairs);
@@ -258,6 +432,19 @@ int parse_dosparams(const char *dosparams_file,
                                 "nmoltypes.\n");
                 exit(1);
             }
+            // cross spectra need the transforms of all molecules
+            size_t dofA_moltype =
+                (*cross_spectra_def)[d].dof_pair_defs[p].dofA_moltype;
+            size_t dofB_moltype =
+                (*cross_spectra_def)[d].dof_pair_defs[p].dofB_moltype;
+            if ((*moltypes_nselected)[dofA_moltype] <
+                    (*moltypes_nmols)[dofA_moltype] ||
+                (*moltypes_nselected)[dofB_moltype] <
+                    (*moltypes_nmols)[dofB_moltype]) {
+                fprintf(stderr, "ERROR: moltypes in cross spectra can not be "
+                                "subsampled (sample_fraction, max_mols).\n");
+                exit(1);
+            }
             if ((*cross_spectra_def)[d].type == 'i' &&
                 ((*cross_spectra_def)[d].dof_pair_defs[p].dofA_moltype !=
                  (*cross_spectra_def)[d].dof_pair_defs[p].dofB_moltype)) {
@@ -300,16 +487,32 @@ int parse_dosparams(const char *dosparams_file,
     return 0;
 }
 
-void print_dosparams(size_t nsamples, size_t nblocks, unsigned long nblocksteps,
-                     size_t nmoltypes, size_t *moltypes_nmols,
-                     size_t *moltypes_natomspermol, float **moltypes_atommasses,
-                     char *moltypes_rot_treat, int **moltypes_abc_indicators) {
-    printf("nsamples: %zu\n", nsamples);
-    printf("nblocks: %zu\n", nblocks);
-    printf("nblocksteps: %lu\n", nblocksteps);
+void print_dosparams(size_t nresolutions, size_t *nsamples, size_t *nblocks,
+                     unsigned long *nblocksteps, real max_frequency,
+                     real block_overlap, char window,
+                     unsigned long subsample_seed, size_t nmoltypes,
+                     size_t *moltypes_nmols, size_t *moltypes_nselected,
+                     size_t *moltypes_natomspermol,
+                     real **moltypes_atommasses, char *moltypes_rot_treat,
+                     int **moltypes_abc_indicators) {
+    for (size_t r = 0; r < nresolutions; r++) {
+        printf("nsamples: %zu\n", nsamples[r]);
+        printf("nblocks: %zu\n", nblocks[r]);
+        printf("nblocksteps: %lu\n", nblocksteps[r]);
+    }
+    if (max_frequency > 0.0) {
+        printf("max_frequency: %f\n", max_frequency);
+    }
+    printf("block_overlap: %f\n", block_overlap);
+    printf("window: %c\n", window);
+    printf("subsample_seed: %lu\n", subsample_seed);
     printf("nmoltypes: %zu\n", nmoltypes);
     for (size_t h = 0; h < nmoltypes; h++) {
         printf("moltype %zu nmols: %zu\n", h, moltypes_nmols[h]);
+        if (moltypes_nselected[h] < moltypes_nmols[h]) {
+            printf("moltype %zu subsampled nmols: %zu\n", h,
+                   moltypes_nselected[h]);
+        }
         printf("moltype %zu natomspermol: %zu\n", h, moltypes_natomspermol[h]);
         printf("moltype %zu atommasses: ", h);
         for (size_t j = 0; j < moltypes_natomspermol[h]; j++)
@@ -323,15 +526,22 @@ void print_dosparams(size_t nsamples, size_t nblocks, unsigned long nblocksteps,
     }
 }
 
-void free_dosparams_arrays(size_t nmoltypes, size_t **moltypes_nmols,
+void free_dosparams_arrays(size_t **nsamples, size_t **nblocks,
+                           unsigned long **nblocksteps, size_t nmoltypes,
+                           size_t **moltypes_nmols,
+                           size_t **moltypes_nselected,
                            size_t **moltypes_natomspermol,
-                           float ***moltypes_atommasses,
+                           real ***moltypes_atommasses,
                            char **moltypes_rot_treat,
                            int ***moltypes_abc_indicators,
                            size_t *ncross_spectra,
                            cross_spectrum_def **cross_spectra_def) {
     // free arrays
+    free(*nsamples);
+    free(*nblocks);
+    free(*nblocksteps);
     free(*moltypes_nmols);
+    free(*moltypes_nselected);
     free(*moltypes_natomspermol);
 
     for (size_t h = 0; h < nmoltypes; h++) {
@@ -354,12 +564,12 @@ void free_dosparams_arrays(size_t nmoltypes, size_t **moltypes_nmols,
 
 void calc_convenience_variables(size_t nmoltypes, size_t *moltypes_nmols,
                                 size_t *moltypes_natomspermol,
-                                float **moltypes_atommasses,
+                                real **moltypes_atommasses,
                                 size_t *natoms, // output
                                 size_t *nmols, size_t *moltypes_firstmol,
                                 size_t *moltypes_firstatom,
                                 size_t **mols_moltypenr, size_t **mols_natoms,
-                                float **mols_mass, size_t **mols_firstatom) {
+                                real **mols_mass, size_t **mols_firstatom) {
     for (size_t h = 0; h < nmoltypes; h++) {
         moltypes_firstmol[h] = *nmols;
         moltypes_firstatom[h] = *natoms;
@@ -368,7 +578,7 @@ void calc_convenience_variables(size_t nmoltypes, size_t *moltypes_nmols,
     }
     *mols_moltypenr = calloc(*nmols, sizeof(size_t));
     *mols_natoms = calloc(*nmols, sizeof(size_t));
-    *mols_mass = calloc(*nmols, sizeof(float));
+    *mols_mass = calloc(*nmols, sizeof(real));
     *mols_firstatom = calloc(*nmols, sizeof(size_t));
     for (size_t i = 0; i < *nmols; i++) {
         for (size_t h = 0; h < nmoltypes; h++) {
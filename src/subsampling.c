@@ -0,0 +1,92 @@
+#include "precision.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tgmath.h>
+
+#ifndef SUBSAMPLING_DEF
+#define SUBSAMPLING_DEF
+
+// splitmix64, small and reproducible on every platform
+uint64_t subsample_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// random subset of moltypes_nselected[h] molecules of every moltype, drawn
+// with a partial Fisher-Yates shuffle, the same seed gives the same subset
+// returns whether any moltype is subsampled
+bool select_mols(size_t nmoltypes, size_t *moltypes_firstmol,
+                 size_t *moltypes_nmols, size_t *moltypes_nselected,
+                 unsigned long seed,
+                 bool *mols_selected) { // output
+    bool subsampled = false;
+    uint64_t state = seed;
+    for (size_t h = 0; h < nmoltypes; h++) {
+        size_t nmols = moltypes_nmols[h];
+        size_t nselected = moltypes_nselected[h];
+        bool *selected = &mols_selected[moltypes_firstmol[h]];
+        if (nselected >= nmols) {
+            for (size_t i0 = 0; i0 < nmols; i0++) {
+                selected[i0] = true;
+            }
+            continue;
+        }
+        subsampled = true;
+        size_t *mols = malloc(nmols * sizeof(size_t));
+        for (size_t i0 = 0; i0 < nmols; i0++) {
+            mols[i0] = i0;
+            selected[i0] = false;
+        }
+        for (size_t k = 0; k < nselected; k++) {
+            size_t j = k + subsample_random(&state) % (nmols - k);
+            size_t swap = mols[k];
+            mols[k] = mols[j];
+            mols[j] = swap;
+            selected[mols[k]] = true;
+        }
+        free(mols);
+    }
+    return subsampled;
+}
+
+// drop the molecules that are not selected from a schedule (see
+// calc_mols_schedule), the order of the others is kept
+// returns the number of molecules left
+size_t filter_mols_order(size_t nmols, bool *mols_selected,
+                         size_t *mols_order) { // in- and output
+    size_t nkept = 0;
+    for (size_t k = 0; k < nmols; k++) {
+        if (mols_selected[mols_order[k]]) {
+            mols_order[nkept++] = mols_order[k];
+        }
+    }
+    return nkept;
+}
+
+// standard error of the mean of the block spectra of each sample from the
+// sums of their squared deviations from the mean ([nspectra][nsamples][n]),
+// zero for samples of a single block
+// consecutive blocks are treated as independent, with overlapping blocks
+// the error is underestimated
+void calc_block_std_error(size_t nspectra, size_t nsamples, unsigned long n,
+                          size_t *samples_nblocks, real *m2,
+                          real *std_error) { // output
+    for (size_t s = 0; s < nspectra; s++) {
+        for (size_t sample = 0; sample < nsamples; sample++) {
+            real nblocks = (real)samples_nblocks[sample];
+            for (unsigned long k = 0; k < n; k++) {
+                size_t q = (s * nsamples + sample) * n + k;
+                std_error[q] =
+                    nblocks < 2.0
+                        ? 0.0
+                        : sqrt(m2[q] / (nblocks * (nblocks - 1.0)));
+            }
+        }
+    }
+}
+
+#endif
@@ -1,26 +1,30 @@
+#include "precision.h"
 #include <chemfiles.h>
-#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <tgmath.h>
 
-void get_frame_pos_box(CHFL_FRAME *frame, size_t natoms, float *pos,
-                       float *box) {
+void get_frame_pos_box(CHFL_FRAME *frame, size_t natoms, real *pos,
+                       real *box) {
 
     // for reading of frame
     CHFL_CELL *cell;
     chfl_vector3d *r = NULL;
     uint64_t natoms_traj = 0;
-    chfl_vector3d box_temp = {0, 0, 0};
+    chfl_vector3d box_temp[3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
 
     chfl_frame_positions(frame, &r, &natoms_traj);
     cell = chfl_cell_from_frame(frame);
-    chfl_cell_lengths(cell, box_temp);
+    chfl_cell_matrix(cell, box_temp);
 
-    box[0] = box_temp[0] / 10.0;
-    box[1] = box_temp[1] / 10.0;
-    box[2] = box_temp[2] / 10.0;
+    // cell matrix (row major) with the cell vectors as columns
+    for (size_t dim = 0; dim < 3; dim++) {
+        box[3 * dim + 0] = box_temp[dim][0] / 10.0;
+        box[3 * dim + 1] = box_temp[dim][1] / 10.0;
+        box[3 * dim + 2] = box_temp[dim][2] / 10.0;
+    }
     for (size_t j = 0; j < natoms; j++) {
         pos[3 * j + 0] = r[j][0] / 10.0;
         pos[3 * j + 1] = r[j][1] / 10.0;
@@ -30,9 +34,10 @@ void get_frame_pos_box(CHFL_FRAME *frame, size_t natoms, float *pos,
     chfl_free(cell);
 }
 
-void get_traj_pos_vel_box(CHFL_TRAJECTORY *file, unsigned long nblocksteps,
-                          size_t natoms, float *block_pos, float *block_vel,
-                          float *block_box) {
+// read the next nframes frames
+void get_traj_pos_vel_box(CHFL_TRAJECTORY *file, unsigned long nframes,
+                          size_t natoms, real *block_pos, real *block_vel,
+                          real *block_box) {
 
     // for reading of frame
     CHFL_FRAME *frame;
@@ -40,19 +45,22 @@ void get_traj_pos_vel_box(CHFL_TRAJECTORY *file, unsigned long nblocksteps,
     chfl_vector3d *r = NULL;
     chfl_vector3d *v = NULL;
     uint64_t natoms_traj = 0;
-    chfl_vector3d box = {0, 0, 0};
+    chfl_vector3d box[3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
 
-    for (unsigned long t = 0; t < nblocksteps; t++) {
+    for (unsigned long t = 0; t < nframes; t++) {
         frame = chfl_frame();
         chfl_trajectory_read(file, frame);
         chfl_frame_positions(frame, &r, &natoms_traj);
         chfl_frame_velocities(frame, &v, &natoms_traj);
         cell = chfl_cell_from_frame(frame);
-        chfl_cell_lengths(cell, box);
+        chfl_cell_matrix(cell, box);
 
-        block_box[3 * t + 0] = box[0] / 10.0;
-        block_box[3 * t + 1] = box[1] / 10.0;
-        block_box[3 * t + 2] = box[2] / 10.0;
+        // cell matrix (row major) with the cell vectors as columns
+        for (size_t dim = 0; dim < 3; dim++) {
+            block_box[9 * t + 3 * dim + 0] = box[dim][0] / 10.0;
+            block_box[9 * t + 3 * dim + 1] = box[dim][1] / 10.0;
+            block_box[9 * t + 3 * dim + 2] = box[dim][2] / 10.0;
+        }
         for (size_t j = 0; j < natoms; j++) {
             block_pos[3 * natoms * t + 3 * j + 0] = r[j][0] / 10.0;
             block_pos[3 * natoms * t + 3 * j + 1] = r[j][1] / 10.0;
@@ -93,20 +101,20 @@ void check_frame_velocities(CHFL_FRAME *frame) {
     }
 }
 
-void check_frame_orthorombic_box(CHFL_FRAME *frame, bool no_pbc) {
+void check_frame_periodic_box(CHFL_FRAME *frame, bool no_pbc) {
     CHFL_CELL *cell = chfl_cell_from_frame(frame);
     chfl_cellshape shape;
     chfl_cell_shape(cell, &shape);
-    if ((no_pbc == false) && (shape != CHFL_CELL_ORTHORHOMBIC)) {
+    if ((no_pbc == false) && (shape == CHFL_CELL_INFINITE)) {
         fprintf(stderr,
-                "ERROR: can not do recombination on non orthorombic box.\n");
+                "ERROR: can not do recombination without a periodic box.\n");
         exit(1);
     }
     chfl_free(cell);
 }
 
-float get_traj_framelength(CHFL_TRAJECTORY *file, CHFL_FRAME *frame) {
-    float framelength;
+real get_traj_framelength(CHFL_TRAJECTORY *file, CHFL_FRAME *frame) {
+    real framelength;
     double time0, time1;
     int result0, result1;
     // get time0
@@ -118,7 +126,7 @@ float get_traj_framelength(CHFL_TRAJECTORY *file, CHFL_FRAME *frame) {
     property = chfl_frame_get_property(frame, "time");
     result1 = chfl_property_get_double(property, &time1);
     chfl_free(property);
-    framelength = (float)(time1 - time0);
+    framelength = (real)(time1 - time0);
     if ((framelength == 0.0) || (result0 != CHFL_SUCCESS) ||
         (result1 != CHFL_SUCCESS)) {
         fprintf(stderr,
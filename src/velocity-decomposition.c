@@ -1,14 +1,19 @@
+#include "cpu-dispatch.c"
 #include "linear-algebra.c"
+#include "precision.h"
 #include <cblas.h>
 #include <lapacke.h>
-#include <math.h>
 #include <omp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <tgmath.h>
 
-float sqrt_neg_zero(float number) {
+#ifndef VELOCITY_DECOMPOSITION_DEF
+#define VELOCITY_DECOMPOSITION_DEF
+
+real sqrt_neg_zero(real number) {
     if (number < -0.001) {
         printf("Trying to take square-root of negative number!\n");
         printf("%f\n", number);
@@ -19,38 +24,63 @@ float sqrt_neg_zero(float number) {
         return sqrt(number);
 }
 
-void recombine_molecule(float *box, size_t m_natoms, float *positions) {
-    for (size_t dim = 0; dim < 3; dim++) {
-        for (size_t j = 1; j < m_natoms; j++) {
-            float dist_to_firstatom =
+// inverse of the cell matrix, needed for fractional coordinates
+void invert_box(real *box, real *box_inv) {
+    CBLAS(copy)(9, box, 1, box_inv, 1);
+    if (invert_matrix(box_inv, 3) != 0) {
+        fprintf(stderr, "ERROR: non-invertible box matrix.\n");
+        exit(1);
+    }
+}
+
+// shift all atoms to the periodic image closest to the first atom
+// box is the cell matrix with the cell vectors as columns, works for
+// orthorhombic and triclinic cells
+void recombine_molecule(real *box, real *box_inv, size_t m_natoms,
+                        real *positions) {
+    for (size_t j = 1; j < m_natoms; j++) {
+        real dist_to_firstatom[3];
+        for (size_t dim = 0; dim < 3; dim++) {
+            dist_to_firstatom[dim] =
                 positions[3 * j + dim] - positions[3 * 0 + dim];
-            if (dist_to_firstatom > 0.5 * box[dim]) {
-                positions[3 * j + dim] -= box[dim];
-            }
-            if (dist_to_firstatom < -0.5 * box[dim]) {
-                positions[3 * j + dim] += box[dim];
-            }
+        }
+        // number of cell vectors to shift (rounded fractional coordinates)
+        real shift[3];
+        for (size_t k = 0; k < 3; k++) {
+            shift[k] = rint(box_inv[3 * k + 0] * dist_to_firstatom[0] +
+                             box_inv[3 * k + 1] * dist_to_firstatom[1] +
+                             box_inv[3 * k + 2] * dist_to_firstatom[2]);
+        }
+        for (size_t dim = 0; dim < 3; dim++) {
+            positions[3 * j + dim] -= box[3 * dim + 0] * shift[0] +
+                                      box[3 * dim + 1] * shift[1] +
+                                      box[3 * dim + 2] * shift[2];
         }
     }
 }
 
 void calculate_refpos_principal_components(
-    float *refpos, float *box, size_t nmols, size_t *mol_firstatom,
-    size_t *mol_natoms, size_t *mol_moltypenr, float **moltypes_atommasses,
-    float *mol_mass, char *moltype_rot_treat, bool no_pbc,
-    float *atom_refpos_principal_components) // from here output
+    real *refpos, real *box, size_t nmols, size_t *mol_firstatom,
+    size_t *mol_natoms, size_t *mol_moltypenr, real **moltypes_atommasses,
+    real *mol_mass, char *moltype_rot_treat, bool no_pbc,
+    real *atom_refpos_principal_components) // from here output
 {
+    // inverse cell matrix for recombination
+    real box_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    if (no_pbc == false) {
+        invert_box(box, box_inv);
+    }
     // iterate molecules
     for (size_t i = 0; i < nmols; i++) {
         size_t m_firstatom = mol_firstatom[i];
         size_t m_natoms = mol_natoms[i];
         size_t m_moltype = mol_moltypenr[i];
-        float m_mass = mol_mass[i];
-        float *m_atommasses = moltypes_atommasses[m_moltype];
+        real m_mass = mol_mass[i];
+        real *m_atommasses = moltypes_atommasses[m_moltype];
         char m_rot_treat = moltype_rot_treat[m_moltype];
         // large arrays
-        float *positions = calloc(3 * m_natoms, sizeof(float));
-        float *positions_rel = calloc(3 * m_natoms, sizeof(float));
+        real *positions = calloc(3 * m_natoms, sizeof(real));
+        real *positions_rel = calloc(3 * m_natoms, sizeof(real));
         // next mol if not eckart frame decomposition
         if (!(m_rot_treat == 'e' || m_rot_treat == 'p')) {
             continue;
@@ -64,13 +94,13 @@ void calculate_refpos_principal_components(
         }
         // recombination
         if (no_pbc == false) {
-            recombine_molecule(box, m_natoms, positions);
+            recombine_molecule(box, box_inv, m_natoms, positions);
         }
         // calc molecule velocity and molecule com
-        float center_of_mass[3] = {0.0, 0.0, 0.0};
+        real center_of_mass[3] = {0.0, 0.0, 0.0};
         for (size_t dim = 0; dim < 3; dim++) {
             center_of_mass[dim] =
-                cblas_sdot(m_natoms, m_atommasses, 1, &positions[0 + dim], 3);
+                CBLAS(dot)(m_natoms, m_atommasses, 1, &positions[0 + dim], 3);
             center_of_mass[dim] /= m_mass;
         }
         // calc molecule atoms relative positions
@@ -81,13 +111,13 @@ void calculate_refpos_principal_components(
             }
         }
         // calc moi tensor
-        float moi_tensor[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        real moi_tensor[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
         moiTensor(m_natoms, positions_rel, m_atommasses, moi_tensor);
         // calc moments of inertia and eigenvectors
-        float eigenvectors[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
-        cblas_scopy(9, moi_tensor, 1, eigenvectors, 1);
-        float moments_of_inertia[3] = {0.0, 0.0, 0.0};
-        if (LAPACKE_ssyev(LAPACK_ROW_MAJOR, 'V', 'U', 3, eigenvectors, 3,
+        real eigenvectors[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        CBLAS(copy)(9, moi_tensor, 1, eigenvectors, 1);
+        real moments_of_inertia[3] = {0.0, 0.0, 0.0};
+        if (LAPACKE(syev)(LAPACK_ROW_MAJOR, 'V', 'U', 3, eigenvectors, 3,
                           moments_of_inertia) > 0) {
             fprintf(stderr,
                     "ERROR: LAPACKE_ssyev failed to compute eigenvalues of\n");
@@ -98,11 +128,11 @@ void calculate_refpos_principal_components(
             exit(1);
         }
         // first dimension: atom, second dimension: dim
-        float *refpos_principal_components =
-            calloc(3 * m_natoms, sizeof(float));
-        float eigenvectors_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+        real *refpos_principal_components =
+            calloc(3 * m_natoms, sizeof(real));
+        real eigenvectors_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                      0.0, 0.0, 0.0, 0.0};
-        cblas_scopy(9, eigenvectors, 1, eigenvectors_inv, 1);
+        CBLAS(copy)(9, eigenvectors, 1, eigenvectors_inv, 1);
         if (invert_matrix(eigenvectors_inv, 3) != 0) {
             fprintf(stderr,
                     "ERROR: non-invertible moi-eigenvector matrix of molecule "
@@ -111,11 +141,11 @@ void calculate_refpos_principal_components(
             exit(1);
         }
         // c = inv(v) @ posref_rel
-        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, 3, m_natoms, 3,
+        CBLAS(gemm)(CblasRowMajor, CblasNoTrans, CblasTrans, 3, m_natoms, 3,
                     1.0, eigenvectors_inv, 3, positions_rel, 3, 0.0,
                     refpos_principal_components, m_natoms);
         // save in array
-        cblas_scopy(m_natoms * 3, refpos_principal_components, 1,
+        CBLAS(copy)(m_natoms * 3, refpos_principal_components, 1,
                     &atom_refpos_principal_components[m_firstatom * 3], 1);
         // free arrays
         free(refpos_principal_components);
@@ -125,44 +155,67 @@ void calculate_refpos_principal_components(
     }
 }
 
+CPU_DISPATCH
 void decompose_velocities(
-    float *block_pos, float *block_vel, float *block_box,
+    real *block_pos, real *block_vel, real *block_box,
     unsigned long nblocksteps, size_t natoms, size_t nmols,
     size_t *mol_firstatom, size_t *mol_natoms, size_t *mol_moltypenr,
-    float **moltypes_atommasses, float *mol_mass, char *moltype_rot_treat,
+    real **moltypes_atommasses, real *mol_mass, char *moltype_rot_treat,
     int **moltype_abc_indicators, bool no_pbc,
-    float *atom_refpos_principal_components,
-    float *mol_velocities_sqrt_m_trn, // from here output
-    float *mol_omegas_sqrt_i_rot, float *atom_velocities_sqrt_m_vib,
-    float *atom_velocities_sqrt_m_rot, float *atom_velocities_sqrt_m_vibc,
-    float *mol_block_moments_of_inertia,
-    float *mol_block_moments_of_inertia_squared, float *mol_block_coriolis) {
-
-    // no dynamic teams since molecules all cause roughly the same work
+    real *atom_refpos_principal_components, size_t *mols_order,
+    bool mols_schedule_dynamic,
+    real *mol_velocities_sqrt_m_trn, // from here output
+    real *mol_omegas_sqrt_i_rot, real *atom_velocities_sqrt_m_vib,
+    real *atom_velocities_sqrt_m_rot, real *atom_velocities_sqrt_m_vibc,
+    real *mol_block_moments_of_inertia,
+    real *mol_block_moments_of_inertia_squared, real *mol_block_coriolis) {
+
+    // no dynamic teams, the molecule schedule takes care of load balancing
     omp_set_dynamic(0);
+    // the frames of one molecule are independent, so molecules and frames
+    // are one iteration space: large molecules are spread over all threads
+    // even if there are fewer molecules than threads
+    // molecules with very different cost (e.g. protein in water) are
+    // scheduled dynamically in order of descending cost (see
+    // calc_mols_schedule) in chunks of frames, otherwise static scheduling
+    // is sufficient
+    if (mols_schedule_dynamic) {
+        int frames_chunk = nblocksteps / omp_get_max_threads();
+        omp_set_schedule(omp_sched_dynamic,
+                         frames_chunk > 0 ? frames_chunk : 1);
+    } else {
+        omp_set_schedule(omp_sched_static, 0);
+    }
 
-    for (unsigned long t = 0; t < nblocksteps; t++) {
-        // arrays for intermediate results to split up molecule loop
-        // loop over molecules
+    // inverse cell matrix of each frame for recombination
+    real *block_box_inv = calloc(9 * nblocksteps, sizeof(real));
+    if (no_pbc == false) {
+        for (unsigned long t = 0; t < nblocksteps; t++) {
+            invert_box(&block_box[9 * t], &block_box_inv[9 * t]);
+        }
+    }
 
-#pragma omp parallel for
-        for (size_t i = 0; i < nmols; i++) {
+    // loop over molecules and frames
+#pragma omp parallel for collapse(2) schedule(runtime)
+    for (size_t k = 0; k < nmols; k++) {
+        for (unsigned long t = 0; t < nblocksteps; t++) {
             // convenience variables
+            size_t i = mols_order[k];
             size_t m_firstatom = mol_firstatom[i];
             size_t m_natoms = mol_natoms[i];
             size_t m_moltype = mol_moltypenr[i];
-            float m_mass = mol_mass[i];
-            float *m_atommasses = moltypes_atommasses[m_moltype];
+            real m_mass = mol_mass[i];
+            real *m_atommasses = moltypes_atommasses[m_moltype];
             int *m_abc_indicators = moltype_abc_indicators[m_moltype];
             char m_rot_treat = moltype_rot_treat[m_moltype];
 
             // large arrays
             // TODO: Better would be to iterate over moltypes and allocate those
             // outside molecule loop
-            float *positions = calloc(3 * m_natoms, sizeof(float));
-            float *velocities = calloc(3 * m_natoms, sizeof(float));
-            float *positions_rel = calloc(3 * m_natoms, sizeof(float));
-            float *velocities_rot = calloc(3 * m_natoms, sizeof(float));
+            real *positions = calloc(3 * m_natoms, sizeof(real));
+            real *velocities = calloc(3 * m_natoms, sizeof(real));
+            real *positions_rel = calloc(3 * m_natoms, sizeof(real));
+            real *velocities_rot = calloc(3 * m_natoms, sizeof(real));
 
             // reading into threadprivate arrays
             for (size_t j = 0; j < m_natoms; j++) {
@@ -177,7 +230,8 @@ void decompose_velocities(
 
             // recombination
             if (no_pbc == false) {
-                recombine_molecule(&block_box[3 * t], m_natoms, positions);
+                recombine_molecule(&block_box[9 * t], &block_box_inv[9 * t],
+                                   m_natoms, positions);
             }
 
             // single atoms
@@ -217,12 +271,12 @@ void decompose_velocities(
             }
 
             // calc molecule velocity and molecule com
-            float center_of_mass[3] = {0.0, 0.0, 0.0};
-            float mol_velocity_trn[3] = {0.0, 0.0, 0.0};
+            real center_of_mass[3] = {0.0, 0.0, 0.0};
+            real mol_velocity_trn[3] = {0.0, 0.0, 0.0};
             // this might also be done by a matrix multiplication but maybe
             // overkill
             for (size_t dim = 0; dim < 3; dim++) {
-                mol_velocity_trn[dim] = cblas_sdot(m_natoms, m_atommasses, 1,
+                mol_velocity_trn[dim] = CBLAS(dot)(m_natoms, m_atommasses, 1,
                                                    &velocities[0 + dim], 3);
                 mol_velocity_trn[dim] /= m_mass;
 
@@ -231,7 +285,7 @@ void decompose_velocities(
                                           nblocksteps * dim + t] =
                     mol_velocity_trn[dim] * sqrt(m_mass);
 
-                center_of_mass[dim] = cblas_sdot(m_natoms, m_atommasses, 1,
+                center_of_mass[dim] = CBLAS(dot)(m_natoms, m_atommasses, 1,
                                                  &positions[0 + dim], 3);
                 center_of_mass[dim] /= m_mass;
             }
@@ -245,8 +299,8 @@ void decompose_velocities(
             }
 
             // calc angular momentum
-            float cross_product[3] = {0.0, 0.0, 0.0};
-            float angular_momentum[3] = {0.0, 0.0, 0.0};
+            real cross_product[3] = {0.0, 0.0, 0.0};
+            real angular_momentum[3] = {0.0, 0.0, 0.0};
             for (size_t j = 0; j < m_natoms; j++) {
                 crossProduct(&positions_rel[3 * j], &velocities[3 * j],
                              cross_product);
@@ -257,30 +311,30 @@ void decompose_velocities(
             }
 
             // calc moi tensor
-            float moi_tensor[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+            real moi_tensor[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
             moiTensor(m_natoms, positions_rel, m_atommasses, moi_tensor);
 
             // calc angular velocity
-            float angular_velocity[3] = {0.0, 0.0, 0.0};
-            float moi_tensor_temp[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+            real angular_velocity[3] = {0.0, 0.0, 0.0};
+            real moi_tensor_temp[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                         0.0, 0.0, 0.0, 0.0};
-            cblas_scopy(9, moi_tensor, 1, moi_tensor_temp, 1);
-            cblas_scopy(3, angular_momentum, 1, angular_velocity, 1);
+            CBLAS(copy)(9, moi_tensor, 1, moi_tensor_temp, 1);
+            CBLAS(copy)(3, angular_momentum, 1, angular_velocity, 1);
             // linear molecules
             if (m_rot_treat == 'l') {
                 // find angular velocity from underdetermined system of linear
                 // equations
-                float S[3] = {0.0, 0.0, 0.0};
+                real S[3] = {0.0, 0.0, 0.0};
                 int rank = 1337;
 
-                LAPACKE_sgelsd(LAPACK_ROW_MAJOR, 3, 3, 1, moi_tensor_temp, 3,
+                LAPACKE(gelsd)(LAPACK_ROW_MAJOR, 3, 3, 1, moi_tensor_temp, 3,
                                angular_velocity, 1, S, 0.001, &rank);
             }
             // non-linear molecules
             else {
                 // find angular velocity from system of linear equations
                 int ipiv[3] = {0, 0, 0};
-                LAPACKE_sgesv(LAPACK_ROW_MAJOR, 3, 1, moi_tensor_temp, 3, ipiv,
+                LAPACKE(gesv)(LAPACK_ROW_MAJOR, 3, 1, moi_tensor_temp, 3, ipiv,
                               angular_velocity, 1);
             }
 
@@ -294,13 +348,13 @@ void decompose_velocities(
             }
 
             // calc velocities vib
-            float velocity_vib[3] = {0.0, 0.0, 0.0};
+            real velocity_vib[3] = {0.0, 0.0, 0.0};
             for (size_t j = 0; j < m_natoms; j++) {
-                cblas_scopy(3, &velocities[3 * j], 1, velocity_vib, 1);
+                CBLAS(copy)(3, &velocities[3 * j], 1, velocity_vib, 1);
 
-                cblas_saxpy(3, -1.0, &velocities_rot[3 * j], 1, velocity_vib,
+                CBLAS(axpy)(3, -1.0, &velocities_rot[3 * j], 1, velocity_vib,
                             1);
-                cblas_saxpy(3, -1.0, mol_velocity_trn, 1, velocity_vib, 1);
+                CBLAS(axpy)(3, -1.0, mol_velocity_trn, 1, velocity_vib, 1);
 
                 // write in output array atom_velocities_sqrt_m_vib
                 size_t atom = m_firstatom + j;
@@ -320,8 +374,8 @@ void decompose_velocities(
                 // calculate series for FFT
                 for (size_t dim = 0; dim < 3; dim++) {
                     /*
-                       if (copysignf(1.0, angular_velocity[dim]) !=
-                       copysignf(1.0, angular_momentum[dim]))
+                       if (copysign(1.0, angular_velocity[dim]) !=
+                       copysign(1.0, angular_momentum[dim]))
                        {
                        fprintf(stderr, "ERROR: angular velocity and
                        angular_momentum don't point in the same direction!\n");
@@ -330,7 +384,7 @@ void decompose_velocities(
                        */
                     mol_omegas_sqrt_i_rot[3 * nblocksteps * i +
                                           nblocksteps * dim + t] =
-                        copysignf(sqrt_neg_zero(angular_velocity[dim] *
+                        copysign(sqrt_neg_zero(angular_velocity[dim] *
                                                 angular_momentum[dim]),
                                   angular_velocity[dim]);
                 }
@@ -342,18 +396,18 @@ void decompose_velocities(
                             moi_tensor[3 * dim + dim];
                         mol_block_moments_of_inertia_squared
                             [3 * nblocksteps * i + nblocksteps * dim + t] +=
-                            powf(moi_tensor[3 * dim + dim], 2.0);
+                            pow(moi_tensor[3 * dim + dim], 2.0);
                     }
                 }
                 continue;
             }
 
             // calc moments of inertia and eigenvectors
-            float eigenvectors[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+            real eigenvectors[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                      0.0, 0.0, 0.0, 0.0};
-            cblas_scopy(9, moi_tensor, 1, eigenvectors, 1);
-            float moments_of_inertia[3] = {0.0, 0.0, 0.0};
-            if (LAPACKE_ssyev(LAPACK_ROW_MAJOR, 'V', 'U', 3, eigenvectors, 3,
+            CBLAS(copy)(9, moi_tensor, 1, eigenvectors, 1);
+            real moments_of_inertia[3] = {0.0, 0.0, 0.0};
+            if (LAPACKE(syev)(LAPACK_ROW_MAJOR, 'V', 'U', 3, eigenvectors, 3,
                               moments_of_inertia) > 0) {
                 fprintf(
                     stderr,
@@ -365,9 +419,9 @@ void decompose_velocities(
             }
 
             // abc auxilary vectors
-            float a[3] = {0.0, 0.0, 0.0};
-            float b[3] = {0.0, 0.0, 0.0};
-            float c[3] = {0.0, 0.0, 0.0};
+            real a[3] = {0.0, 0.0, 0.0};
+            real b[3] = {0.0, 0.0, 0.0};
+            real c[3] = {0.0, 0.0, 0.0};
 
             // about the abc_indicators
             // two numbers define a, two define b', c is cross product of a and
@@ -385,38 +439,38 @@ void decompose_velocities(
                     b[dim] -= positions_rel[3 * m_abc_indicators[3] + dim];
             }
             // normalize a
-            cblas_sscal(3, 1 / cblas_snrm2(3, &a[0], 1), &a[0], 1);
+            CBLAS(scal)(3, 1 / CBLAS(nrm2)(3, &a[0], 1), &a[0], 1);
 
             // calculate c and b
             crossProduct(a, b, c);
             crossProduct(c, a, b);
 
             // normalize b and c
-            cblas_sscal(3, 1 / cblas_snrm2(3, &b[0], 1), &b[0], 1);
-            cblas_sscal(3, 1 / cblas_snrm2(3, &c[0], 1), &c[0], 1);
+            CBLAS(scal)(3, 1 / CBLAS(nrm2)(3, &b[0], 1), &b[0], 1);
+            CBLAS(scal)(3, 1 / CBLAS(nrm2)(3, &c[0], 1), &c[0], 1);
 
             // check if eigenvector points in same general direction as abc
             // if not flip eigenvector
-            if (cblas_sdot(3, &eigenvectors[0], 3, a, 1) < 0.0)
-                cblas_sscal(3, -1.0, &eigenvectors[0], 3);
-            if (cblas_sdot(3, &eigenvectors[1], 3, b, 1) < 0.0)
-                cblas_sscal(3, -1.0, &eigenvectors[1], 3);
-            if (cblas_sdot(3, &eigenvectors[2], 3, c, 1) < 0.0)
-                cblas_sscal(3, -1.0, &eigenvectors[2], 3);
+            if (CBLAS(dot)(3, &eigenvectors[0], 3, a, 1) < 0.0)
+                CBLAS(scal)(3, -1.0, &eigenvectors[0], 3);
+            if (CBLAS(dot)(3, &eigenvectors[1], 3, b, 1) < 0.0)
+                CBLAS(scal)(3, -1.0, &eigenvectors[1], 3);
+            if (CBLAS(dot)(3, &eigenvectors[2], 3, c, 1) < 0.0)
+                CBLAS(scal)(3, -1.0, &eigenvectors[2], 3);
 
             // angular velocity for output later
             // can be full ω or Eckart Ω
-            float output_angular_velocity[3];
+            real output_angular_velocity[3];
             // cases where it is ω
             if (m_rot_treat == 'f' || m_rot_treat == 'a') {
-                cblas_scopy(3, angular_velocity, 1, output_angular_velocity, 1);
+                CBLAS(copy)(3, angular_velocity, 1, output_angular_velocity, 1);
             }
 
             // eckart frame decomposition
             if (m_rot_treat == 'e' || m_rot_treat == 'p' ||
                 m_rot_treat == 'E' || m_rot_treat == 'P') {
                 // calculate Eckart vectors F (F_i in rows)
-                float F[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+                real F[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
                 for (size_t j = 0; j < m_natoms; j++) {
                     for (size_t dim1 = 0; dim1 < 3; dim1++) {
                         for (size_t dim2 = 0; dim2 < 3; dim2++) {
@@ -430,16 +484,16 @@ void decompose_velocities(
                 }
                 // calculate Eckart frame f
                 // f has f1,f2,f3 in columns
-                float f[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+                real f[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
                 // planar molecule
                 if (m_rot_treat == 'p' || m_rot_treat == 'P') {
                     // gram_matrix = F12 @ F12.T
-                    float gram_matrix[4] = {0.0, 0.0, 0.0, 0.0};
-                    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, 2, 2,
+                    real gram_matrix[4] = {0.0, 0.0, 0.0, 0.0};
+                    CBLAS(gemm)(CblasRowMajor, CblasNoTrans, CblasTrans, 2, 2,
                                 3, 1.0, F, 3, F, 3, 0.0, gram_matrix, 2);
                     // invert gram matrix
-                    float gram_matrix_inv[4] = {0.0, 0.0, 0.0, 0.0};
-                    cblas_scopy(4, gram_matrix, 1, gram_matrix_inv, 1);
+                    real gram_matrix_inv[4] = {0.0, 0.0, 0.0, 0.0};
+                    CBLAS(copy)(4, gram_matrix, 1, gram_matrix_inv, 1);
                     if (invert_matrix(gram_matrix_inv, 2) != 0) {
                         fprintf(stderr,
                                 "ERROR: non-invertible Gram matrix of molecule "
@@ -448,8 +502,8 @@ void decompose_velocities(
                         exit(1);
                     }
                     // squareroot of inverse gram matrix
-                    float gram_matrix_inv_sqrt[4] = {0.0, 0.0, 0.0, 0.0};
-                    cblas_scopy(4, gram_matrix_inv, 1, gram_matrix_inv_sqrt, 1);
+                    real gram_matrix_inv_sqrt[4] = {0.0, 0.0, 0.0, 0.0};
+                    CBLAS(copy)(4, gram_matrix_inv, 1, gram_matrix_inv_sqrt, 1);
                     if (squareroot_of_matrix(gram_matrix_inv_sqrt, 2)) {
                         fprintf(stderr,
                                 "ERROR: could not take square root of the\n");
@@ -459,27 +513,27 @@ void decompose_velocities(
                         exit(1);
                     }
                     // Eckart frame f1 f2
-                    cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, 3, 2,
+                    CBLAS(gemm)(CblasRowMajor, CblasTrans, CblasNoTrans, 3, 2,
                                 2, 1.0, F, 3, gram_matrix_inv_sqrt, 2, 0.0, f,
                                 3);
                     // f3 = f1 x f2
-                    float f1[3] = {f[0], f[3], f[6]};
-                    float f2[3] = {f[1], f[4], f[7]};
-                    float f3[3] = {0.0, 0.0, 0.0};
+                    real f1[3] = {f[0], f[3], f[6]};
+                    real f2[3] = {f[1], f[4], f[7]};
+                    real f3[3] = {0.0, 0.0, 0.0};
                     crossProduct(f1, f2, f3);
-                    cblas_scopy(3, f3, 1, &f[2], 3);
+                    CBLAS(copy)(3, f3, 1, &f[2], 3);
                 }
                 // non-planar molecule
                 else if (m_rot_treat == 'e' || m_rot_treat == 'E') {
                     // gram_matrix = F12 @ F12.T
-                    float gram_matrix[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+                    real gram_matrix[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                             0.0, 0.0, 0.0, 0.0};
-                    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, 3, 3,
+                    CBLAS(gemm)(CblasRowMajor, CblasNoTrans, CblasTrans, 3, 3,
                                 3, 1.0, F, 3, F, 3, 0.0, gram_matrix, 3);
                     // invert gram matrix
-                    float gram_matrix_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+                    real gram_matrix_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                                 0.0, 0.0, 0.0, 0.0};
-                    cblas_scopy(9, gram_matrix, 1, gram_matrix_inv, 1);
+                    CBLAS(copy)(9, gram_matrix, 1, gram_matrix_inv, 1);
                     if (invert_matrix(gram_matrix_inv, 3) != 0) {
                         fprintf(stderr,
                                 "ERROR: non-invertible Gram matrix of molecule "
@@ -488,10 +542,10 @@ void decompose_velocities(
                         exit(1);
                     }
                     // squareroot of inverse gram matrix
-                    float gram_matrix_inv_sqrt[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+                    real gram_matrix_inv_sqrt[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                                      0.0, 0.0, 0.0, 0.0};
 
-                    cblas_scopy(9, gram_matrix_inv, 1, gram_matrix_inv_sqrt, 1);
+                    CBLAS(copy)(9, gram_matrix_inv, 1, gram_matrix_inv_sqrt, 1);
                     if (squareroot_of_matrix(gram_matrix_inv_sqrt, 3)) {
                         fprintf(stderr,
                                 "ERROR: could not take square root of the\n");
@@ -501,17 +555,17 @@ void decompose_velocities(
                         exit(1);
                     }
                     // Eckart frame
-                    cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, 3, 3,
+                    CBLAS(gemm)(CblasRowMajor, CblasTrans, CblasNoTrans, 3, 3,
                                 3, 1.0, F, 3, gram_matrix_inv_sqrt, 3, 0.0, f,
                                 3);
                 }
                 // check F, f from Louck et al. Σ_i F_i x f_i = 0
-                float check_louck[3] = {0.0, 0.0, 0.0};
-                float cross_product[3] = {0.0, 0.0, 0.0};
+                real check_louck[3] = {0.0, 0.0, 0.0};
+                real cross_product[3] = {0.0, 0.0, 0.0};
                 for (size_t dim = 0; dim < 3; dim++) {
                     crossProductInc(&F[3 * dim], 1, &f[dim], 3, cross_product,
                                     1);
-                    cblas_saxpy(3, 1.0, cross_product, 1, check_louck, 1);
+                    CBLAS(axpy)(3, 1.0, cross_product, 1, check_louck, 1);
                 }
                 // Not sure what number is reasonable here
                 if (fabs(check_louck[0]) > 1.0e-3 ||
@@ -525,7 +579,7 @@ void decompose_velocities(
                 }
                 // positions of reference in lab frame, one atom per row
                 // sablic (8)
-                float *c_alpha = calloc(m_natoms * 3, sizeof(float));
+                real *c_alpha = calloc(m_natoms * 3, sizeof(real));
                 for (size_t j = 0; j < m_natoms; j++) {
                     for (size_t dim1 = 0; dim1 < 3; dim1++) {
                         for (size_t dim2 = 0; dim2 < 3; dim2++) {
@@ -540,12 +594,12 @@ void decompose_velocities(
                 // condition
 
                 // calculate J' tensor
-                float J_prime[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+                real J_prime[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                     0.0, 0.0, 0.0, 0.0};
                 moiTensorMixed(m_natoms, positions_rel, c_alpha, m_atommasses,
                                J_prime);
                 // Eckart angular momentum
-                float eckart_angular_momentum[3] = {0.0, 0.0, 0.0};
+                real eckart_angular_momentum[3] = {0.0, 0.0, 0.0};
                 for (size_t j = 0; j < m_natoms; j++) {
                     crossProduct(&c_alpha[3 * j], &velocities[3 * j],
                                  cross_product);
@@ -555,30 +609,30 @@ void decompose_velocities(
                     }
                 }
                 // Eckart angular velocity Ω
-                float eckart_angular_velocity[3] = {0.0, 0.0, 0.0};
+                real eckart_angular_velocity[3] = {0.0, 0.0, 0.0};
                 // J'
-                float J_prime_temp[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+                real J_prime_temp[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                          0.0, 0.0, 0.0, 0.0};
-                cblas_scopy(9, J_prime, 1, J_prime_temp, 1);
-                cblas_scopy(3, eckart_angular_momentum, 1,
+                CBLAS(copy)(9, J_prime, 1, J_prime_temp, 1);
+                CBLAS(copy)(3, eckart_angular_momentum, 1,
                             eckart_angular_velocity, 1);
                 // find Ω from system of linear equations
                 int ipiv[3] = {0, 0, 0};
-                LAPACKE_sgesv(LAPACK_ROW_MAJOR, 3, 1, J_prime_temp, 3, ipiv,
+                LAPACKE(gesv)(LAPACK_ROW_MAJOR, 3, 1, J_prime_temp, 3, ipiv,
                               eckart_angular_velocity, 1);
                 // save Ω for later
-                cblas_scopy(3, eckart_angular_velocity, 1,
+                CBLAS(copy)(3, eckart_angular_velocity, 1,
                             output_angular_velocity, 1);
                 // total angular velocity ω - Eckart angular velocity Ω
-                float omega_minus_Omega[3] = {0.0, 0.0, 0.0};
-                cblas_scopy(3, angular_velocity, 1, omega_minus_Omega, 1);
-                cblas_saxpy(3, -1.0, eckart_angular_velocity, 1,
+                real omega_minus_Omega[3] = {0.0, 0.0, 0.0};
+                CBLAS(copy)(3, angular_velocity, 1, omega_minus_Omega, 1);
+                CBLAS(axpy)(3, -1.0, eckart_angular_velocity, 1,
                             omega_minus_Omega, 1);
                 // vibrational motion coupled with rotation u
                 // u_j = (ω - Ω) x δr_j
                 // and Coriolis energy term
                 // Σ_j u_j · (Ω x δr_j)
-                float velocity_vibc[3] = {0.0, 0.0, 0.0};
+                real velocity_vibc[3] = {0.0, 0.0, 0.0};
                 for (size_t j = 0; j < m_natoms; j++) {
                     size_t atom = m_firstatom + j;
                     // vibc
@@ -590,7 +644,7 @@ void decompose_velocities(
                     // add coriolis energy
                     mol_block_coriolis[nblocksteps * i + t] +=
                         m_atommasses[j] *
-                        cblas_sdot(3, velocity_vibc, 1, cross_product, 1);
+                        CBLAS(dot)(3, velocity_vibc, 1, cross_product, 1);
                     // write in output array atom_velocities_sqrt_m_vibc
                     for (size_t dim = 0; dim < 3; dim++) {
                         atom_velocities_sqrt_m_vibc[3 * nblocksteps * atom +
@@ -613,7 +667,7 @@ void decompose_velocities(
                     mol_block_moments_of_inertia_squared[3 * nblocksteps * i +
                                                          nblocksteps * dim +
                                                          t] +=
-                        powf(moments_of_inertia[dim], 2.0);
+                        pow(moments_of_inertia[dim], 2.0);
                 }
                 */
 
@@ -624,25 +678,25 @@ void decompose_velocities(
             if (m_rot_treat == 'a' || m_rot_treat == 'E' ||
                 m_rot_treat == 'P') {
                 // matrix abc which is used for transfroming in aux frame
-                float abc[9];
-                cblas_scopy(3, a, 1, &abc[0], 3);
-                cblas_scopy(3, b, 1, &abc[1], 3);
-                cblas_scopy(3, c, 1, &abc[2], 3);
+                real abc[9];
+                CBLAS(copy)(3, a, 1, &abc[0], 3);
+                CBLAS(copy)(3, b, 1, &abc[1], 3);
+                CBLAS(copy)(3, c, 1, &abc[2], 3);
 
                 // calculate angular velocity in abc coords
-                float angular_velocity_abc[3] = {0.0, 0.0, 0.0};
+                real angular_velocity_abc[3] = {0.0, 0.0, 0.0};
                 // angular_velocity_abc = angular_velocity @ abc
                 for (size_t dim = 0; dim < 3; dim++) {
                     angular_velocity_abc[dim] =
-                        cblas_sdot(3, output_angular_velocity, 1, &abc[dim], 3);
+                        CBLAS(dot)(3, output_angular_velocity, 1, &abc[dim], 3);
                 }
 
                 // calc moi_tensor in abc coords
-                float temp_matrix[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+                real temp_matrix[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                         0.0, 0.0, 0.0, 0.0};
-                float abc_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+                real abc_inv[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                     0.0, 0.0, 0.0, 0.0};
-                cblas_scopy(9, abc, 1, abc_inv, 1);
+                CBLAS(copy)(9, abc, 1, abc_inv, 1);
                 if (invert_matrix(abc_inv, 3) != 0) {
                     fprintf(stderr,
                             "ERROR: non-invertible abc matrix of molecule "
@@ -651,14 +705,14 @@ void decompose_velocities(
                     exit(1);
                 }
                 // temp_matrix = abc_inv @ moi_tensor
-                cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, 3, 3, 3,
+                CBLAS(gemm)(CblasRowMajor, CblasNoTrans, CblasNoTrans, 3, 3, 3,
                             1.0, abc_inv, 3, moi_tensor, 3, 0.0, temp_matrix,
                             3);
 
                 // moi_abc = temp_matrix @ abc
-                float moi_tensor_abc[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
+                real moi_tensor_abc[9] = {0.0, 0.0, 0.0, 0.0, 0.0,
                                            0.0, 0.0, 0.0, 0.0};
-                cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, 3, 3, 3,
+                CBLAS(gemm)(CblasRowMajor, CblasNoTrans, CblasNoTrans, 3, 3, 3,
                             1.0, temp_matrix, 3, abc, 3, 0.0, moi_tensor_abc,
                             3);
 
@@ -676,7 +730,7 @@ void decompose_velocities(
                     mol_block_moments_of_inertia_squared[3 * nblocksteps * i +
                                                          nblocksteps * dim +
                                                          t] +=
-                        powf(moi_tensor_abc[3 * dim + dim], 2.0);
+                        pow(moi_tensor_abc[3 * dim + dim], 2.0);
                 }
                 continue;
             }
@@ -685,9 +739,9 @@ void decompose_velocities(
             if (m_rot_treat == 'f' || m_rot_treat == 'e' ||
                 m_rot_treat == 'p') {
                 // calculate angular velocity in pa coords
-                float angular_velocity_pa[3] = {0.0, 0.0, 0.0};
+                real angular_velocity_pa[3] = {0.0, 0.0, 0.0};
                 for (size_t dim = 0; dim < 3; dim++) {
-                    angular_velocity_pa[dim] = cblas_sdot(
+                    angular_velocity_pa[dim] = CBLAS(dot)(
                         3, output_angular_velocity, 1, &eigenvectors[dim], 3);
                 }
                 // writing in output arrays
@@ -704,7 +758,7 @@ void decompose_velocities(
                     mol_block_moments_of_inertia_squared[3 * nblocksteps * i +
                                                          nblocksteps * dim +
                                                          t] +=
-                        powf(moments_of_inertia[dim], 2.0);
+                        pow(moments_of_inertia[dim], 2.0);
                 }
             }
 
@@ -714,4 +768,7 @@ void decompose_velocities(
             free(velocities_rot);
         }
     }
+    free(block_box_inv);
 }
+
+#endif
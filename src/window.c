@@ -0,0 +1,71 @@
+#include "precision.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tgmath.h>
+
+#ifndef WINDOW_DEF
+#define WINDOW_DEF
+
+// window function of n points applied to every series before the FFT
+// 'r': rectangular (no window), 'h': Hann, 'b': Blackman
+// the periodic forms are used, they are exact for overlaps of 1/2 (Hann) and
+// 2/3 (Blackman)
+void calc_window(char window, unsigned long n, real *weights) { // output
+    for (unsigned long t = 0; t < n; t++) {
+        real phase = 2.0 * M_PI * t / n;
+        switch (window) {
+        case 'h':
+            weights[t] = 0.5 - 0.5 * cos(phase);
+            break;
+        case 'b':
+            weights[t] = 0.42 - 0.5 * cos(phase) + 0.08 * cos(2.0 * phase);
+            break;
+        default:
+            weights[t] = 1.0;
+        }
+    }
+}
+
+// mean square of the window, the power of a windowed series is reduced by
+// this factor
+real calc_window_power(unsigned long n, real *weights) {
+    real power = 0.0;
+    for (unsigned long t = 0; t < n; t++) {
+        power += weights[t] * weights[t];
+    }
+    return power / n;
+}
+
+// sum of w(t) w(t + tau) for every lag, with the n points of the window
+// zero padded to the FFT length npoints and wrapped around modulo npoints
+// like the correlation from the inverse FFT, this replaces the number of
+// frame pairs: n (circular, npoints = n), n - tau (linear, npoints at least
+// 2 n - 1) or a mix of both in between (circular with --zero-pad)
+void calc_window_lag_weights(unsigned long n, real *weights,
+                             unsigned long npoints, unsigned long nlags,
+                             real *lag_weights) { // output
+    for (unsigned long tau = 0; tau < nlags; tau++) {
+        real sum = 0.0;
+        for (unsigned long t = 0; t < n; t++) {
+            unsigned long shifted = (t + tau) % npoints;
+            if (shifted < n) {
+                sum += weights[t] * weights[shifted];
+            }
+        }
+        lag_weights[tau] = sum;
+    }
+}
+
+// multiply nseries series of n points with the window
+void apply_window(size_t nseries, unsigned long n, real *weights,
+                  real *series) {
+#pragma omp parallel for schedule(static)
+    for (size_t s = 0; s < nseries; s++) {
+        for (unsigned long t = 0; t < n; t++) {
+            series[s * n + t] *= weights[t];
+        }
+    }
+}
+
+#endif
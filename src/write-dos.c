@@ -1,207 +1,134 @@
-#include "cjson/cJSON.h"
+#include "json-writer.c"
+#include "precision.h"
 #include "structs.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 
-int write_to_file(const char *filename, char *content) {
-    FILE *file = fopen(filename, "wb");
-    if (file == NULL)
-        return 1;
-    fputs(content, file);
-    fclose(file);
-    return 0;
-}
-
-int write_dos(const char *dos_file, size_t nsamples, unsigned long nblocksteps,
-              unsigned long nfrequencies, float framelength, size_t ndos,
-              size_t ncross_spectra, const char **dos_names, size_t nmoltypes,
-              float *moltypes_dos_samples, float *moltypes_dos_cross_samples,
-              float *moltypes_samples_moments_of_inertia,
-              float *moltypes_samples_moments_of_inertia_std,
-              cross_spectrum_def *cross_spectra_def,
-              float *moltypes_samples_coriolis) {
-
-    cJSON *root = cJSON_CreateObject();
-    if (root == NULL)
-        return 1;
+#ifndef WRITE_DOS_DEF
+#define WRITE_DOS_DEF
+
+// results of one block length, written as members of the open json object
+// samples_nblocks (blocks used per sample) is only written if not NULL,
+// the frequencies are those of the FFT length nfftpoints (after decimation
+// and zero padding) at framelength
+void write_dos_json(json_writer *writer, size_t nsamples,
+                    size_t *samples_nblocks, unsigned long nfftpoints,
+                    unsigned long nfrequencies, real framelength, size_t ndos,
+                    size_t ncross_spectra, const char **dos_names,
+                    size_t nmoltypes, real *moltypes_dos_samples,
+                    size_t *moltypes_nmols, size_t *moltypes_nselected,
+                    real *moltypes_dos_std_error_samples,
+                    real *moltypes_dos_cross_samples,
+                    real *moltypes_samples_moments_of_inertia,
+                    real *moltypes_samples_moments_of_inertia_std,
+                    cross_spectrum_def *cross_spectra_def,
+                    real *moltypes_samples_coriolis, unsigned long nlags,
+                    real lag_time, real *moltypes_correlation_samples,
+                    real *cross_correlation_samples) {
+    // working precision of the executable
+    json_string(writer, "precision", PRECISION_NAME);
+
+    // blocks of each sample (only if samples can end early)
+    if (samples_nblocks) {
+        json_begin_array(writer, "nblocks_used");
+        for (size_t sample = 0; sample < nsamples; sample++) {
+            json_integer(writer, NULL, samples_nblocks[sample]);
+        }
+        json_end_array(writer);
+    }
 
     // frequencies
-    cJSON *frequencies = cJSON_AddArrayToObject(root, "frequencies");
-    if (frequencies == NULL)
-        return 1;
+    json_begin_array(writer, "frequencies");
     for (unsigned long t = 0; t < nfrequencies; t++) {
-        cJSON *number =
-            cJSON_CreateNumber(t / (framelength * (float)nblocksteps));
-        if (number == NULL)
-            return 1;
-        cJSON_AddItemToArray(frequencies, number);
+        json_number(writer, NULL, t / (framelength * (real)nfftpoints));
+    }
+    json_end_array(writer);
+
+    // correlation times (only with correlation functions)
+    if (nlags > 0) {
+        json_begin_array(writer, "times");
+        for (unsigned long tau = 0; tau < nlags; tau++) {
+            json_number(writer, NULL, tau * lag_time);
+        }
+        json_end_array(writer);
     }
 
     // moltypes array
-    cJSON *moltypes = cJSON_AddArrayToObject(root, "moltypes");
-    if (moltypes == NULL)
-        return 1;
+    json_begin_array(writer, "moltypes");
     for (size_t h = 0; h < nmoltypes; h++) {
-        // moltype object
-        cJSON *moltype = cJSON_CreateObject();
-        if (moltype == NULL)
-            return 1;
-        cJSON_AddItemToArray(moltypes, moltype);
+        json_begin_object(writer, NULL);
 
-        // spectra object
-        cJSON *spectra = cJSON_CreateObject();
-        if (spectra == NULL)
-            return 1;
-        cJSON_AddItemToObject(moltype, "spectra", spectra);
-
-        // fill spectra
+        // spectra object, one array of samples per component
+        json_begin_object(writer, "spectra");
         for (size_t d = 0; d < ndos; d++) {
-            // this_dos array
-            cJSON *this_dos = cJSON_AddArrayToObject(spectra, dos_names[d]);
-            if (this_dos == NULL)
-                return 1;
-
-            // fill dos_data array
-            for (size_t sample = 0; sample < nsamples; sample++) {
-                // dos_data_sample array
-                cJSON *dos_data_sample = cJSON_CreateArray();
-                if (dos_data_sample == NULL)
-                    return 1;
-                cJSON_AddItemToArray(this_dos, dos_data_sample);
-
-                // fill dos_data_sample array
-                for (unsigned long t = 0; t < nfrequencies; t++) {
-                    int index = h * ndos * nsamples * nfrequencies +
-                                d * nsamples * nfrequencies +
-                                sample * nfrequencies + t;
-                    // single number
-                    cJSON *number =
-                        cJSON_CreateNumber(moltypes_dos_samples[index]);
-                    if (number == NULL)
-                        return 1;
-                    cJSON_AddItemToArray(dos_data_sample, number);
-                }
-            }
+            size_t index = h * ndos * nsamples * nfrequencies +
+                           d * nsamples * nfrequencies;
+            json_samples(writer, dos_names[d], nsamples, nfrequencies,
+                         &moltypes_dos_samples[index]);
         }
+        json_end_object(writer);
 
-        // moi array
-        cJSON *moi = cJSON_AddArrayToObject(moltype, "moments_of_inertia");
-        if (moi == NULL)
-            return 1;
-
-        // fill moi array
-        for (size_t sample = 0; sample < nsamples; sample++) {
-            // this_moi array
-            cJSON *this_moi = cJSON_CreateArray();
-            if (this_moi == NULL)
-                return 1;
-            cJSON_AddItemToArray(moi, this_moi);
-
-            // fill this_moi array
-            for (size_t abc = 0; abc < 3; abc++) {
-                size_t index = h * nsamples * 3 + sample * 3 + abc;
-                // single number
-                cJSON *number = cJSON_CreateNumber(
-                    moltypes_samples_moments_of_inertia[index]);
-                if (number == NULL)
-                    return 1;
-                cJSON_AddItemToArray(this_moi, number);
-            }
+        // subsampled moltypes: molecules processed and the standard error
+        // of the spectra (same layout as spectra, only with nblocks > 1)
+        if (moltypes_nselected[h] < moltypes_nmols[h]) {
+            json_integer(writer, "nmols_subsampled", moltypes_nselected[h]);
         }
-        // moi_std array
-        cJSON *moi_std =
-            cJSON_AddArrayToObject(moltype, "moments_of_inertia_std");
-        if (moi_std == NULL)
-            return 1;
-
-        // fill moi_std array
-        for (size_t sample = 0; sample < nsamples; sample++) {
-            // this_moi array
-            cJSON *this_moi_std = cJSON_CreateArray();
-            if (this_moi_std == NULL)
-                return 1;
-            cJSON_AddItemToArray(moi_std, this_moi_std);
-
-            // fill this_moi_std array
-            for (size_t abc = 0; abc < 3; abc++) {
-                size_t index = h * nsamples * 3 + sample * 3 + abc;
-                // single number
-                cJSON *number = cJSON_CreateNumber(
-                    moltypes_samples_moments_of_inertia_std[index]);
-                if (number == NULL)
-                    return 1;
-                cJSON_AddItemToArray(this_moi_std, number);
+        if (moltypes_nselected[h] < moltypes_nmols[h] &&
+            moltypes_dos_std_error_samples) {
+            json_begin_object(writer, "spectra_std_error");
+            for (size_t d = 0; d < ndos; d++) {
+                size_t index = h * ndos * nsamples * nfrequencies +
+                               d * nsamples * nfrequencies;
+                json_samples(writer, dos_names[d], nsamples, nfrequencies,
+                             &moltypes_dos_std_error_samples[index]);
             }
+            json_end_object(writer);
         }
-        // coriolis energy
-        cJSON *coriolis = cJSON_AddArrayToObject(moltype, "coriolis");
-        if (coriolis == NULL)
-            return 1;
-
-        // fill moi array
-        for (size_t sample = 0; sample < nsamples; sample++) {
-            size_t index = h * nsamples + sample;
-            // single number
-            cJSON *number =
-                cJSON_CreateNumber(moltypes_samples_coriolis[index]);
-            if (number == NULL)
-                return 1;
-            cJSON_AddItemToArray(coriolis, number);
-        }
-    }
-
-    // dos_cross array
-    cJSON *cross_spectra = cJSON_CreateObject();
-    cJSON_AddItemToObject(root, "cross_spectra", cross_spectra);
-    if (cross_spectra == NULL)
-        return 1;
-
-    // fill dos_cross array
-    for (size_t d = 0; d < ncross_spectra; d++) {
-        // this_dos array
-        cJSON *this_dos =
-            cJSON_AddArrayToObject(cross_spectra, cross_spectra_def[d].name);
-        if (this_dos == NULL)
-            return 1;
 
-        // fill dos_data array
-        for (size_t sample = 0; sample < nsamples; sample++) {
-            // dos_data_sample array
-            cJSON *dos_data_sample = cJSON_CreateArray();
-            if (dos_data_sample == NULL)
-                return 1;
-            cJSON_AddItemToArray(this_dos, dos_data_sample);
-
-            // fill dos_data_sample array
-            for (unsigned long t = 0; t < nfrequencies; t++) {
+        // correlations object, same layout as spectra
+        if (nlags > 0) {
+            json_begin_object(writer, "correlations");
+            for (size_t d = 0; d < ndos; d++) {
                 size_t index =
-                    +d * nsamples * nfrequencies + sample * nfrequencies + t;
-                // single number
-                cJSON *number =
-                    cJSON_CreateNumber(moltypes_dos_cross_samples[index]);
-                if (number == NULL)
-                    return 1;
-                cJSON_AddItemToArray(dos_data_sample, number);
+                    h * ndos * nsamples * nlags + d * nsamples * nlags;
+                json_samples(writer, dos_names[d], nsamples, nlags,
+                             &moltypes_correlation_samples[index]);
             }
+            json_end_object(writer);
         }
-    }
 
-    // generate json string
-    char *string = cJSON_Print(root);
-    if (string == NULL) {
-        fprintf(stderr, "ERROR: Failed generate json.\n");
-        return 1;
-    }
-    cJSON_Delete(root);
+        // moi, its std. deviation and the Coriolis energy of each sample
+        json_samples(writer, "moments_of_inertia", nsamples, 3,
+                     &moltypes_samples_moments_of_inertia[h * nsamples * 3]);
+        json_samples(
+            writer, "moments_of_inertia_std", nsamples, 3,
+            &moltypes_samples_moments_of_inertia_std[h * nsamples * 3]);
+        json_numbers(writer, "coriolis", nsamples,
+                     &moltypes_samples_coriolis[h * nsamples]);
 
-    // write string to file
-    if (write_to_file(dos_file, string) != 0) {
-        fprintf(stderr, "ERROR: Failed write json to file.\n");
-        return 1;
+        json_end_object(writer);
     }
-    free(string);
+    json_end_array(writer);
 
-    return 0;
+    // cross spectra object
+    json_begin_object(writer, "cross_spectra");
+    for (size_t d = 0; d < ncross_spectra; d++) {
+        json_samples(writer, cross_spectra_def[d].name, nsamples,
+                     nfrequencies,
+                     &moltypes_dos_cross_samples[d * nsamples * nfrequencies]);
+    }
+    json_end_object(writer);
+
+    // cross correlations object
+    if (nlags > 0) {
+        json_begin_object(writer, "cross_correlations");
+        for (size_t d = 0; d < ncross_spectra; d++) {
+            json_samples(writer, cross_spectra_def[d].name, nsamples, nlags,
+                         &cross_correlation_samples[d * nsamples * nlags]);
+        }
+        json_end_object(writer);
+    }
 }
+
+#endif
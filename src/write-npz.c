@@ -0,0 +1,400 @@
+#include "json-writer.c"
+#include "precision.h"
+#include "structs.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WRITE_NPZ_DEF
+#define WRITE_NPZ_DEF
+
+// numpy's npz format: a zip archive of .npy files, here stored without
+// compression so that the arrays can be memory-mapped, always with zip64
+// records since results can exceed 4 GiB
+#define NPZ_MAX_NAME 128
+#define NPZ_VERSION 45 // zip64
+#define NPZ_COPY_SIZE (1 << 20)
+
+typedef struct {
+    char name[NPZ_MAX_NAME];
+    uint32_t crc;
+    uint64_t size;
+    uint64_t offset; // of the local header
+} npz_member;
+
+typedef struct {
+    FILE *file;
+    uint64_t offset;
+    size_t nmembers;
+    npz_member *members;
+} npz_writer;
+
+uint32_t npz_crc_table[256];
+
+void init_npz_crc_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        }
+        npz_crc_table[i] = crc;
+    }
+}
+
+// CRC-32 of zip, continued from crc (0 at the start)
+uint32_t npz_crc(uint32_t crc, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = npz_crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// little endian integer of nbytes bytes, advances the header pointer
+void npz_put(unsigned char **header, uint64_t value, int nbytes) {
+    for (int i = 0; i < nbytes; i++) {
+        *(*header)++ = (unsigned char)(value >> (8 * i));
+    }
+}
+
+// returns 1 if the file can not be opened
+int npz_open(npz_writer *npz, const char *filename) {
+    npz->file = fopen(filename, "wb");
+    if (npz->file == NULL)
+        return 1;
+    npz->offset = 0;
+    npz->nmembers = 0;
+    npz->members = NULL;
+    init_npz_crc_table();
+    return 0;
+}
+
+// local file header of the next member of size bytes, with the sizes in
+// the zip64 extra field
+void npz_begin_member(npz_writer *npz, const char *name, uint32_t crc,
+                      uint64_t size) {
+    if (strlen(name) >= NPZ_MAX_NAME) {
+        fprintf(stderr, "ERROR: npz member name %s too long.\n", name);
+        exit(1);
+    }
+    npz->members =
+        realloc(npz->members, (npz->nmembers + 1) * sizeof(npz_member));
+    npz_member *member = &npz->members[npz->nmembers++];
+    strcpy(member->name, name);
+    member->crc = crc;
+    member->size = size;
+    member->offset = npz->offset;
+
+    unsigned char header[30 + NPZ_MAX_NAME + 20];
+    unsigned char *h = header;
+    size_t name_length = strlen(name);
+    npz_put(&h, 0x04034b50, 4);
+    npz_put(&h, NPZ_VERSION, 2);
+    npz_put(&h, 0, 2);      // flags
+    npz_put(&h, 0, 2);      // stored
+    npz_put(&h, 0, 2);      // time
+    npz_put(&h, 0x0021, 2); // date (1980-01-01)
+    npz_put(&h, crc, 4);
+    npz_put(&h, 0xFFFFFFFF, 4);
+    npz_put(&h, 0xFFFFFFFF, 4);
+    npz_put(&h, name_length, 2);
+    npz_put(&h, 20, 2);
+    memcpy(h, name, name_length);
+    h += name_length;
+    npz_put(&h, 0x0001, 2);
+    npz_put(&h, 16, 2);
+    npz_put(&h, size, 8);
+    npz_put(&h, size, 8);
+    fwrite(header, 1, h - header, npz->file);
+    npz->offset += (h - header) + size;
+}
+
+// uncompressed member of the archive, its content is prefix followed by data
+void npz_write_member(npz_writer *npz, const char *name, const void *prefix,
+                      size_t prefix_size, const void *data, size_t data_size) {
+    npz_begin_member(npz, name,
+                     npz_crc(npz_crc(0, prefix, prefix_size), data, data_size),
+                     prefix_size + data_size);
+    fwrite(prefix, 1, prefix_size, npz->file);
+    fwrite(data, 1, data_size, npz->file);
+}
+
+// same, with data_size bytes of data from the start of the file data
+void npz_copy_member(npz_writer *npz, const char *name, const void *prefix,
+                     size_t prefix_size, FILE *data, size_t data_size) {
+    char *buffer = malloc(NPZ_COPY_SIZE);
+    uint32_t crc = npz_crc(0, prefix, prefix_size);
+    rewind(data);
+    for (size_t copied = 0; copied < data_size; copied += NPZ_COPY_SIZE) {
+        size_t n = fread(buffer, 1, NPZ_COPY_SIZE, data);
+        crc = npz_crc(crc, buffer, n);
+    }
+    npz_begin_member(npz, name, crc, prefix_size + data_size);
+    fwrite(prefix, 1, prefix_size, npz->file);
+    rewind(data);
+    for (size_t copied = 0; copied < data_size; copied += NPZ_COPY_SIZE) {
+        size_t n = fread(buffer, 1, NPZ_COPY_SIZE, data);
+        fwrite(buffer, 1, n, npz->file);
+    }
+    free(buffer);
+}
+
+// .npy version 1.0 header of an array of shape[0] x ... x shape[ndim - 1]
+// reals: magic, header length and a python dict padded with spaces to a
+// multiple of 64 bytes, returns its size
+#define NPY_MAX_HEADER 256
+size_t npy_header(size_t ndim, const size_t *shape,
+                  unsigned char *header) { // output
+    const uint16_t one = 1;
+    char dict[NPY_MAX_HEADER];
+    int length = sprintf(dict, "{'descr': '%cf%zu', 'fortran_order': False, "
+                               "'shape': (",
+                         *(const char *)&one ? '<' : '>', sizeof(real));
+    for (size_t i = 0; i < ndim; i++) {
+        length += sprintf(&dict[length], i > 0 ? ", %zu" : "%zu", shape[i]);
+    }
+    length += sprintf(&dict[length], ndim == 1 ? ",), }" : "), }");
+    int dict_length = (10 + length + 1 + 63) / 64 * 64 - 10;
+    memset(&dict[length], ' ', dict_length - 1 - length);
+    dict[dict_length - 1] = '\n';
+
+    unsigned char *h = header;
+    memcpy(h, "\x93NUMPY\x01\x00", 8);
+    h += 8;
+    npz_put(&h, dict_length, 2);
+    memcpy(h, dict, dict_length);
+    return 10 + dict_length;
+}
+
+// name.npy with the array of shape[0] x ... x shape[ndim - 1] reals
+void npz_write_array(npz_writer *npz, const char *name, size_t ndim,
+                     const size_t *shape, const real *data) {
+    unsigned char header[10 + NPY_MAX_HEADER];
+    size_t header_size = npy_header(ndim, shape, header);
+    size_t nvalues = 1;
+    for (size_t i = 0; i < ndim; i++) {
+        nvalues *= shape[i];
+    }
+    char member_name[NPZ_MAX_NAME];
+    snprintf(member_name, NPZ_MAX_NAME, "%s.npy", name);
+    npz_write_member(npz, member_name, header, header_size, data,
+                     nvalues * sizeof(real));
+}
+
+// same, with the reals from the start of the file data
+void npz_copy_array(npz_writer *npz, const char *name, size_t ndim,
+                    const size_t *shape, FILE *data) {
+    unsigned char header[10 + NPY_MAX_HEADER];
+    size_t header_size = npy_header(ndim, shape, header);
+    size_t nvalues = 1;
+    for (size_t i = 0; i < ndim; i++) {
+        nvalues *= shape[i];
+    }
+    char member_name[NPZ_MAX_NAME];
+    snprintf(member_name, NPZ_MAX_NAME, "%s.npy", name);
+    npz_copy_member(npz, member_name, header, header_size, data,
+                    nvalues * sizeof(real));
+}
+
+// central directory and end records, returns 1 if anything could not be
+// written
+int npz_close(npz_writer *npz) {
+    uint64_t directory_offset = npz->offset;
+    for (size_t m = 0; m < npz->nmembers; m++) {
+        npz_member *member = &npz->members[m];
+        unsigned char header[46 + NPZ_MAX_NAME + 28];
+        unsigned char *h = header;
+        size_t name_length = strlen(member->name);
+        npz_put(&h, 0x02014b50, 4);
+        npz_put(&h, NPZ_VERSION, 2); // made by
+        npz_put(&h, NPZ_VERSION, 2); // needed
+        npz_put(&h, 0, 2);
+        npz_put(&h, 0, 2);
+        npz_put(&h, 0, 2);
+        npz_put(&h, 0x0021, 2);
+        npz_put(&h, member->crc, 4);
+        npz_put(&h, 0xFFFFFFFF, 4);
+        npz_put(&h, 0xFFFFFFFF, 4);
+        npz_put(&h, name_length, 2);
+        npz_put(&h, 28, 2);
+        npz_put(&h, 0, 2); // comment
+        npz_put(&h, 0, 2); // disk
+        npz_put(&h, 0, 2); // internal attributes
+        npz_put(&h, 0, 4); // external attributes
+        npz_put(&h, 0xFFFFFFFF, 4);
+        memcpy(h, member->name, name_length);
+        h += name_length;
+        npz_put(&h, 0x0001, 2);
+        npz_put(&h, 24, 2);
+        npz_put(&h, member->size, 8);
+        npz_put(&h, member->size, 8);
+        npz_put(&h, member->offset, 8);
+        fwrite(header, 1, h - header, npz->file);
+        npz->offset += h - header;
+    }
+
+    // zip64 end of central directory record and locator, end of central
+    // directory record pointing to them
+    unsigned char end[56 + 20 + 22];
+    unsigned char *h = end;
+    npz_put(&h, 0x06064b50, 4);
+    npz_put(&h, 44, 8);
+    npz_put(&h, NPZ_VERSION, 2);
+    npz_put(&h, NPZ_VERSION, 2);
+    npz_put(&h, 0, 4);
+    npz_put(&h, 0, 4);
+    npz_put(&h, npz->nmembers, 8);
+    npz_put(&h, npz->nmembers, 8);
+    npz_put(&h, npz->offset - directory_offset, 8);
+    npz_put(&h, directory_offset, 8);
+    npz_put(&h, 0x07064b50, 4);
+    npz_put(&h, 0, 4);
+    npz_put(&h, npz->offset, 8);
+    npz_put(&h, 1, 4);
+    npz_put(&h, 0x06054b50, 4);
+    npz_put(&h, 0, 2);
+    npz_put(&h, 0, 2);
+    npz_put(&h, 0xFFFF, 2);
+    npz_put(&h, 0xFFFF, 2);
+    npz_put(&h, 0xFFFFFFFF, 4);
+    npz_put(&h, 0xFFFFFFFF, 4);
+    npz_put(&h, 0, 2);
+    fwrite(end, 1, h - end, npz->file);
+
+    int result = ferror(npz->file) != 0;
+    result |= fclose(npz->file) != 0;
+    free(npz->members);
+    return result;
+}
+
+// results of one block length as arrays prefix<name>.npy (the keys of
+// dos.json, moltypes as first axis) and prefixmetadata.json with the names
+// of the spectra, the molecules and the blocks
+// samples_nblocks (blocks used per sample) is only written if not NULL
+void write_dos_npz(npz_writer *npz, const char *prefix, size_t nsamples,
+                   size_t *samples_nblocks, unsigned long nblocksteps,
+                   unsigned long nfftpoints, unsigned long nfrequencies,
+                   real framelength, size_t ndos, size_t ncross_spectra,
+                   const char **dos_names, size_t nmoltypes,
+                   real *moltypes_dos_samples, size_t *moltypes_nmols,
+                   size_t *moltypes_nselected,
+                   real *moltypes_dos_std_error_samples,
+                   real *moltypes_dos_cross_samples,
+                   real *moltypes_samples_moments_of_inertia,
+                   real *moltypes_samples_moments_of_inertia_std,
+                   cross_spectrum_def *cross_spectra_def,
+                   real *moltypes_samples_coriolis, unsigned long nlags,
+                   real lag_time, real *moltypes_correlation_samples,
+                   real *cross_correlation_samples) {
+    char name[NPZ_MAX_NAME];
+
+    // metadata, small json
+    char *metadata;
+    size_t metadata_size;
+    json_writer writer;
+    json_open_stream(&writer, open_memstream(&metadata, &metadata_size));
+    json_begin_object(&writer, NULL);
+    json_string(&writer, "precision", PRECISION_NAME);
+    json_integer(&writer, "nblocksteps", nblocksteps);
+    if (samples_nblocks) {
+        json_begin_array(&writer, "nblocks_used");
+        for (size_t sample = 0; sample < nsamples; sample++) {
+            json_integer(&writer, NULL, samples_nblocks[sample]);
+        }
+        json_end_array(&writer);
+    }
+    json_begin_array(&writer, "dos_names");
+    for (size_t d = 0; d < ndos; d++) {
+        json_string(&writer, NULL, dos_names[d]);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "cross_spectra_names");
+    for (size_t d = 0; d < ncross_spectra; d++) {
+        json_string(&writer, NULL, cross_spectra_def[d].name);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "nmols");
+    for (size_t h = 0; h < nmoltypes; h++) {
+        json_integer(&writer, NULL, moltypes_nmols[h]);
+    }
+    json_end_array(&writer);
+    json_begin_array(&writer, "nmols_subsampled");
+    for (size_t h = 0; h < nmoltypes; h++) {
+        json_integer(&writer, NULL, moltypes_nselected[h]);
+    }
+    json_end_array(&writer);
+    json_end_object(&writer);
+    if (json_close(&writer) != 0) {
+        fprintf(stderr, "ERROR: Could not write npz metadata.\n");
+        exit(1);
+    }
+    snprintf(name, NPZ_MAX_NAME, "%smetadata.json", prefix);
+    npz_write_member(npz, name, NULL, 0, metadata, metadata_size);
+    free(metadata);
+
+    // frequencies and correlation times
+    real *frequencies = malloc(nfrequencies * sizeof(real));
+    for (unsigned long t = 0; t < nfrequencies; t++) {
+        frequencies[t] = t / (framelength * (real)nfftpoints);
+    }
+    size_t shape[4] = {nfrequencies};
+    snprintf(name, NPZ_MAX_NAME, "%sfrequencies", prefix);
+    npz_write_array(npz, name, 1, shape, frequencies);
+    free(frequencies);
+    if (nlags > 0) {
+        real *times = malloc(nlags * sizeof(real));
+        for (unsigned long tau = 0; tau < nlags; tau++) {
+            times[tau] = tau * lag_time;
+        }
+        shape[0] = nlags;
+        snprintf(name, NPZ_MAX_NAME, "%stimes", prefix);
+        npz_write_array(npz, name, 1, shape, times);
+        free(times);
+    }
+
+    // spectra [moltype][dos][sample][frequency]
+    shape[0] = nmoltypes;
+    shape[1] = ndos;
+    shape[2] = nsamples;
+    shape[3] = nfrequencies;
+    snprintf(name, NPZ_MAX_NAME, "%sspectra", prefix);
+    npz_write_array(npz, name, 4, shape, moltypes_dos_samples);
+    if (moltypes_dos_std_error_samples) {
+        snprintf(name, NPZ_MAX_NAME, "%sspectra_std_error", prefix);
+        npz_write_array(npz, name, 4, shape, moltypes_dos_std_error_samples);
+    }
+    if (nlags > 0) {
+        shape[3] = nlags;
+        snprintf(name, NPZ_MAX_NAME, "%scorrelations", prefix);
+        npz_write_array(npz, name, 4, shape, moltypes_correlation_samples);
+    }
+
+    // moi, its std. deviation [moltype][sample][abc] and the Coriolis
+    // energy [moltype][sample]
+    shape[1] = nsamples;
+    shape[2] = 3;
+    snprintf(name, NPZ_MAX_NAME, "%smoments_of_inertia", prefix);
+    npz_write_array(npz, name, 3, shape, moltypes_samples_moments_of_inertia);
+    snprintf(name, NPZ_MAX_NAME, "%smoments_of_inertia_std", prefix);
+    npz_write_array(npz, name, 3, shape,
+                    moltypes_samples_moments_of_inertia_std);
+    snprintf(name, NPZ_MAX_NAME, "%scoriolis", prefix);
+    npz_write_array(npz, name, 2, shape, moltypes_samples_coriolis);
+
+    // cross spectra [cross spectrum][sample][frequency]
+    shape[0] = ncross_spectra;
+    shape[1] = nsamples;
+    shape[2] = nfrequencies;
+    snprintf(name, NPZ_MAX_NAME, "%scross_spectra", prefix);
+    npz_write_array(npz, name, 3, shape, moltypes_dos_cross_samples);
+    if (nlags > 0) {
+        shape[2] = nlags;
+        snprintf(name, NPZ_MAX_NAME, "%scross_correlations", prefix);
+        npz_write_array(npz, name, 3, shape, cross_correlation_samples);
+    }
+}
+
+#endif